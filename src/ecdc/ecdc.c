@@ -20,13 +20,81 @@
  * SOFTWARE.
  */
 
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "ecdc.h"
 
 
+// -------------------------------------------------------------------- Atomics
+
+// The receive ring indices are shared between an interrupt (or thread) and
+// the pump, and the shared registry is used from several threads. C11 atomics
+// are used when available, then the GCC builtins. As a last resort, plain
+// volatile accesses are only safe for the ring on a single core, and the
+// registry is not available
+#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) \
+    && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_size_t                   ring_index_t;
+#define RING_LOAD_RELAXED(p)            atomic_load_explicit((p), memory_order_relaxed)
+#define RING_LOAD_ACQUIRE(p)            atomic_load_explicit((p), memory_order_acquire)
+#define RING_STORE_RELAXED(p, v)        atomic_store_explicit((p), (v), memory_order_relaxed)
+#define RING_STORE_RELEASE(p, v)        atomic_store_explicit((p), (v), memory_order_release)
+#define RING_INIT(p, v)                 atomic_init((p), (v))
+
+typedef _Atomic(void *)                 atomic_ptr_t;
+#define PTR_LOAD_ACQUIRE(p)             atomic_load_explicit((p), memory_order_acquire)
+#define PTR_LOAD_SEQ_CST(p)             atomic_load_explicit((p), memory_order_seq_cst)
+#define PTR_STORE_RELEASE(p, v)         atomic_store_explicit((p), (v), memory_order_release)
+#define PTR_STORE_SEQ_CST(p, v)         atomic_store_explicit((p), (v), memory_order_seq_cst)
+#define PTR_INIT(p, v)                  atomic_init((p), (v))
+
+typedef atomic_flag                     spin_lock_t;
+#define SPIN_LOCK_INIT(l)               atomic_flag_clear(l)
+#define SPIN_LOCK(l)                                                          \
+    while(atomic_flag_test_and_set_explicit((l), memory_order_acquire)) { }
+#define SPIN_UNLOCK(l)                  atomic_flag_clear_explicit((l), memory_order_release)
+#define HAVE_ATOMICS                    1
+#elif defined(__GNUC__)
+typedef size_t                          ring_index_t;
+#define RING_LOAD_RELAXED(p)            __atomic_load_n((p), __ATOMIC_RELAXED)
+#define RING_LOAD_ACQUIRE(p)            __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define RING_STORE_RELAXED(p, v)        __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define RING_STORE_RELEASE(p, v)        __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define RING_INIT(p, v)                 (*(p) = (v))
+
+typedef void *                          atomic_ptr_t;
+#define PTR_LOAD_ACQUIRE(p)             __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define PTR_LOAD_SEQ_CST(p)             __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define PTR_STORE_RELEASE(p, v)         __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define PTR_STORE_SEQ_CST(p, v)         __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define PTR_INIT(p, v)                  (*(p) = (v))
+
+typedef bool                            spin_lock_t;
+#define SPIN_LOCK_INIT(l)               __atomic_clear((l), __ATOMIC_RELAXED)
+#define SPIN_LOCK(l)                                                          \
+    while(__atomic_test_and_set((l), __ATOMIC_ACQUIRE)) { }
+#define SPIN_UNLOCK(l)                  __atomic_clear((l), __ATOMIC_RELEASE)
+#define HAVE_ATOMICS                    1
+#else
+typedef volatile size_t                 ring_index_t;
+#define RING_LOAD_RELAXED(p)            (*(p))
+#define RING_LOAD_ACQUIRE(p)            (*(p))
+#define RING_STORE_RELAXED(p, v)        (*(p) = (v))
+#define RING_STORE_RELEASE(p, v)        (*(p) = (v))
+#define RING_INIT(p, v)                 (*(p) = (v))
+#define HAVE_ATOMICS                    0
+#endif
+
+#if ECDC_ENABLE_REGISTRY && !HAVE_ATOMICS
+#error "The shared registry needs C11 atomics or GCC atomic builtins"
+#endif
+
+
 // ------------------------------------------------------------ Private settings
 
 // Size of the control sequence buffer. There is no upper bound specified
@@ -39,71 +107,461 @@
 // performance reasons)
 #define DEFAULT_PROMPT                  " # "
 
+// Number of characters that ecdc_pump_console will process per call for a
+// getc console. Bulk read and receive ring consoles drain their input on
+// every call
+#define DEFAULT_PUMP_BUDGET             8
+
+// Initial number of entries in the command index. The index doubles in size
+// whenever it fills up
+#define INITIAL_INDEX_SIZE              8
+
+// Number of failed lines listed in the batch mode summary. Failures past
+// this are still counted
+#define BATCH_MAX_FAILED_LINES          8
+
+
+// ------------------------------------------------------------ Static commands
+
+#if ECDC_ENABLE_STATIC_COMMANDS
+// Provided by the linker when at least one ECDC_COMMAND is linked in. These are
+// weak so that an image without any static commands still links
+extern const struct ecdc_static_command __start_ecdc_commands[]
+    __attribute__((weak));
+extern const struct ecdc_static_command __stop_ecdc_commands[]
+    __attribute__((weak));
+
+#define STATIC_COMMANDS_BEGIN           (__start_ecdc_commands)
+#define STATIC_COMMANDS_END             (__stop_ecdc_commands)
+#else
+#define STATIC_COMMANDS_BEGIN           ((const struct ecdc_static_command *) NULL)
+#define STATIC_COMMANDS_END             ((const struct ecdc_static_command *) NULL)
+#endif /* ECDC_ENABLE_STATIC_COMMANDS */
+
 
 // -------------------------------------------------------------- Private types
 
 typedef void (*console_state_fn)(struct ecdc_console *);
 
 
+// Single producer, single consumer receive ring. The producer and consumer
+// indices are kept at least a cache line apart so that the interrupt and the
+// pump don't fight over the same line. The indices count up forever, and are
+// masked to get a position in data
+struct rx_ring {
+    // Producer (interrupt) side
+    union {
+        struct {
+            ring_index_t                head;
+            ring_index_t                overflow;
+        } p;
+        char                            pad[ECDC_CACHE_LINE_SIZE];
+    } producer;
+
+    // Consumer (pump) side
+    union {
+        struct {
+            ring_index_t                tail;
+        } c;
+        char                            pad[ECDC_CACHE_LINE_SIZE];
+    } consumer;
+
+    // Read only after allocation
+    size_t                              mask;
+    char *                              data;
+};
+
+
+#if ECDC_ENABLE_REGISTRY
+// Shared registry. Readers never lock, they find the current snapshot and
+// publish it in their hazard pointer. Writers build a new snapshot, swap it
+// in, and only free the old one once no hazard pointer refers to it
+struct registry_entry {
+    const char *                        name;
+    ecdc_callback_fn                    callback;
+    void *                              hint;
+};
+
+
+// Immutable once published. Names are stored after the entries
+struct registry_snapshot {
+    struct registry_snapshot *          next_retired;
+    size_t                              count;
+    struct registry_entry               entries[];
+};
+
+
+// One per attached console, a cache line each so that readers don't share
+union registry_reader {
+    struct {
+        atomic_ptr_t                    hazard;
+        bool                            used;
+    } r;
+    char                                pad[ECDC_CACHE_LINE_SIZE];
+};
+
+
+struct ecdc_registry {
+    atomic_ptr_t                        current;
+
+    // Writer state, protected by write_lock
+    spin_lock_t                         write_lock;
+    struct registry_snapshot *          retired;
+
+    size_t                              reader_count;
+    union registry_reader *             readers;
+};
+#endif /* ECDC_ENABLE_REGISTRY */
+
+
+// Command history. Entries are packed back to back in a byte ring, with their
+// length stored before and after the text so that the ring can be walked in
+// either direction. The oldest entries are evicted to make room
+struct history {
+    char *                              data;
+    size_t                              size;
+    size_t                              used;
+
+    // Where the next entry goes, and the oldest entry
+    size_t                              head;
+    size_t                              tail;
+
+    // Entry being recalled
+    size_t                              cursor;
+    bool                                f_browsing;
+};
+
+#define HISTORY_LENGTH_SIZE             2
+#define HISTORY_FRAME_SIZE              (2 * HISTORY_LENGTH_SIZE)
+#define HISTORY_MAX_ENTRY_LENGTH        0xFFFF
+
+
+#if ECDC_ENABLE_TRACE
+// Event trace ring. Only the pump writes to it. The head counts up forever,
+// and is published after the entry it covers so that a reader that
+// interrupts the pump only has to skip the slot being overwritten
+struct trace_ring {
+    ring_index_t                        head;
+    size_t                              mask;
+    struct ecdc_trace_entry *           entries;
+};
+#endif /* ECDC_ENABLE_TRACE */
+
+
+// Output that the write function hasn't accepted yet, in order. Output that
+// doesn't fit is dropped and counted
+struct tx_queue {
+    char *                              data;
+    size_t                              size;
+    size_t                              head;
+    size_t                              len;
+    size_t                              dropped;
+};
+
+
+// Caller provided storage that buffers are carved out of. A NULL base means
+// that buffers come from the heap
+struct storage_arena {
+    char *                              base;
+    size_t                              size;
+    size_t                              used;
+};
+
+
+// Where a command's storage came from
+enum command_storage {
+    COMMAND_STORAGE_HEAP,
+    COMMAND_STORAGE_CALLER,
+    COMMAND_STORAGE_POOL
+};
+
+
+// Command slab pool. Commands are carved out of the storage after this header.
+// A heap pool outlives its console while commands taken from it are still
+// allocated, and the last of them to be freed frees the pool
+struct command_pool {
+    struct ecdc_command *               free;
+    size_t                              max_name_size;
+    size_t                              taken;
+    bool                                f_orphaned;
+};
+
+
 struct ecdc_command {
-    // Command linked list storage
+    // Command linked list storage. Free pool slots are linked through next
     struct ecdc_command *               next;
+    struct ecdc_command *               prev;
     struct ecdc_console *               console;
 
 
-    // Callback
+    // Callback. Resumable commands have a resumable callback instead
     ecdc_callback_fn                    callback;
+    ecdc_resumable_fn                   resumable;
     void *                              hint;
 
 
-    // Command info
-    char *                              name;
+    // Storage the command was allocated from
+    struct command_pool *               pool;
+    enum command_storage                storage;
+
+
+    // Group for batch unregistering
+    int                                 group;
+
+
+    // Execution profile
+    #if ECDC_ENABLE_PROFILER
+    struct ecdc_profile                 profile;
+    #endif /* ECDC_ENABLE_PROFILER */
+
+
+    // Command info, stored inline after the structure
+    char                                name[];
 };
 
 
 struct ecdc_console {
-    // Command linked list root pointer
+    // Command linked list root and tail pointers
     struct ecdc_command *               root;
+    struct ecdc_command *               tail;
+
+
+    // Command index, sorted by name. The linked list keeps the registration
+    // order, this is only used for lookups. Inserts and removals move the
+    // entries after the position, so they are linear in the command count.
+    // If the index could not be grown it is marked invalid, and lookups fall
+    // back to walking the list
+    struct ecdc_command **              index;
+    size_t                              index_count;
+    size_t                              index_size;
+    bool                                f_index_valid;
 
 
     // Argument line storage
     char *                              arg_line;
     size_t                              arg_line_size;
     size_t                              arg_line_write_index;
+    bool                                f_line_overflow;
 
 
-    // Argument pointer storage
+    // Argument pointer storage. Arguments are tracked as characters arrive,
+    // so argv is complete once the line is
     const char **                       argv;
+    size_t                              argc;
     size_t                              max_argc;
 
 
     // Console read / write
     ecdc_getc_fn                        getc;
+    ecdc_read_fn                        read;
     ecdc_puts_fn                        puts;
+    ecdc_write_fn                       write;
     void *                              hint;
     int                                 snoop_char;
 
 
+    // Bulk read storage. Characters left in the read window are consumed
+    // before the transport is polled again
+    char *                              read_buffer;
+    size_t                              read_buffer_size;
+    const char *                        rx_ptr;
+    size_t                              rx_len;
+
+
+    // Resumable command that is running, and what it needs to be called
+    // again. argv is left alone until it is done
+    struct ecdc_command *               running;
+    void *                              running_state;
+    size_t                              running_argc;
+    bool                                f_yield;
+
+
+    // Shared registry this console reads from, and its reader slot
+    struct ecdc_registry *              registry;
+    size_t                              registry_slot;
+
+
+    // Receive ring. While the read window points into the ring, rx_ring_span
+    // is the size of the window, and is handed back when it has been consumed
+    struct rx_ring *                    rx_ring;
+    size_t                              rx_ring_span;
+
+
+    // Command history, NULL if there is none
+    struct history *                    history;
+
+
+    // Output queue for a write function that can accept partial writes,
+    // NULL when output goes to puts
+    struct tx_queue *                   tx_queue;
+
+
+    // Output staging buffer
+    char *                              tx_buffer;
+    size_t                              tx_buffer_size;
+    size_t                              tx_len;
+    size_t                              tx_reserved;
+
+
     // State machine
     console_state_fn                    state;
 
 
+    // Pump budget
+    size_t                              budget;
+    bool                                f_input_eof;
+    bool                                f_feeding;
+
+
     // Control sequence handling
     char                                cs_buffer[CS_BUFFER_SIZE];
     size_t                              cs_write_index;
 
 
+    // Framed mode. The request being received, and the response being sent
+    uint16_t                            frame_id;
+    uint16_t                            frame_rx_crc;
+    uint16_t                            frame_tx_crc;
+    size_t                              frame_rx_len;
+    unsigned char                       frame_status;
+    bool                                f_frame_escape;
+    bool                                f_frame_error;
+    bool                                f_frame_open;
+    bool                                f_frame_notify;
+
+
+    // Batch mode. The first failed lines are kept for the summary
+    bool                                f_batch;
+    bool                                f_batch_cr;
+    uint32_t                            batch_lines;
+    uint32_t                            batch_failed;
+    uint32_t                            batch_failed_lines[BATCH_MAX_FAILED_LINES];
+
+
+    // Statistics counters, and the clock that pumps are timed with
+    #if ECDC_ENABLE_STATS
+    struct ecdc_stats                   stats;
+    ecdc_clock_fn                       stats_clock;
+    #endif /* ECDC_ENABLE_STATS */
+
+
+    // Cycle counter that commands are profiled with
+    #if ECDC_ENABLE_PROFILER
+    ecdc_clock_fn                       profile_clock;
+    #endif /* ECDC_ENABLE_PROFILER */
+
+
+    // Optional event trace, and its clock
+    #if ECDC_ENABLE_TRACE
+    struct trace_ring *                 trace;
+    ecdc_clock_fn                       trace_clock;
+    #endif /* ECDC_ENABLE_TRACE */
+
+
     // Flags and settings
     bool                                f_local_echo;
+    bool                                f_prefix_match;
+    bool                                f_batch_control;
+    bool                                f_in_pump;
     enum ecdc_mode                      mode;
 
-    // Prompt
-    char  *                             prompt;
+    // Prompt. This is owned by the console when it was allocated from the
+    // heap, otherwise it is a reference to the caller's string
+    const char *                        prompt;
+
+
+    // Storage that the console's buffers were carved out of
+    struct storage_arena                arena;
+
+
+    // Command slab pool
+    struct command_pool *               pool;
 };
 
 
+// Statistics counters cost nothing when they are disabled
+#if ECDC_ENABLE_STATS
+#  define STATS_ADD(console, counter, n)    ((console)->stats.counter += (n))
+#else
+#  define STATS_ADD(console, counter, n)    ((void) 0)
+#endif /* ECDC_ENABLE_STATS */
+
+#define STATS_INC(console, counter)         STATS_ADD(console, counter, 1)
+
+
+// Trace events cost nothing when tracing is disabled, and a check when no
+// trace was allocated
+#if ECDC_ENABLE_TRACE
+#  define TRACE(console, event, payload)                                      \
+    do {                                                                      \
+        if(NULL != (console)->trace) {                                        \
+            trace_record((console), (event), (payload));                      \
+        }                                                                     \
+    } while(0)
+#else
+#  define TRACE(console, event, payload)    ((void) 0)
+#endif /* ECDC_ENABLE_TRACE */
+
+
+// Compile time check of the structure size bounds used for storage sizing
+#define STATIC_ASSERT(name, condition)                                        \
+    typedef char static_assert_##name[(condition) ? 1 : -1]
+
+STATIC_ASSERT(console_struct_size,
+              sizeof(struct ecdc_console) <= ECDC_CONSOLE_STRUCT_SIZE);
+STATIC_ASSERT(command_struct_size,
+              sizeof(struct ecdc_command) <= ECDC_COMMAND_STRUCT_SIZE);
+STATIC_ASSERT(command_pool_struct_size,
+              sizeof(struct command_pool) <= ECDC_COMMAND_POOL_STRUCT_SIZE);
+STATIC_ASSERT(rx_ring_struct_size,
+              sizeof(struct rx_ring) <= ECDC_RX_RING_STRUCT_SIZE);
+STATIC_ASSERT(history_struct_size,
+              sizeof(struct history) <= ECDC_HISTORY_STRUCT_SIZE);
+STATIC_ASSERT(tx_queue_struct_size,
+              sizeof(struct tx_queue) <= ECDC_OUTPUT_QUEUE_STRUCT_SIZE);
+#if ECDC_ENABLE_TRACE
+STATIC_ASSERT(trace_struct_size,
+              sizeof(struct trace_ring) <= ECDC_TRACE_STRUCT_SIZE);
+#endif /* ECDC_ENABLE_TRACE */
+
+
 // ---------------------------------------------------------- Private functions
 
+static void *
+arena_alloc(struct storage_arena * arena, size_t size)
+{
+    uintptr_t start = (uintptr_t) (arena->base + arena->used);
+    size_t padding = (ECDC_STORAGE_ALIGNMENT - (start % ECDC_STORAGE_ALIGNMENT))
+        % ECDC_STORAGE_ALIGNMENT;
+
+    size_t remaining = arena->size - arena->used;
+    if((padding > remaining) || (size > (remaining - padding))) {
+        return NULL;
+    }
+
+    void * ret = arena->base + arena->used + padding;
+    arena->used += padding + size;
+    return ret;
+}
+
+static void *
+console_alloc(struct ecdc_console * console, size_t size)
+{
+    if(NULL == console->arena.base) {
+        return malloc(size);
+    }
+    return arena_alloc(&console->arena, size);
+}
+
+static void
+console_free(struct ecdc_console * console, void * ptr)
+{
+    // Storage carved out of an arena is never reclaimed
+    if(NULL == console->arena.base) {
+        free(ptr);
+    }
+}
+
 static inline char *
 ecdc_strdup(const char * s)
 {
@@ -123,465 +581,2582 @@ ecdc_strdup(const char * s)
 }
 
 
+// ----------------------- Command pool
+
 static struct ecdc_command *
-locate_command(struct ecdc_console * console,
-               const char * name)
+pool_take(struct command_pool * pool, size_t name_size)
 {
-    struct ecdc_command * ret = NULL;
+    struct ecdc_command * command = NULL;
 
-    if(NULL != console) {
-        struct ecdc_command * node = NULL;
-        for(node = console->root; NULL != node; node = node->next) {
-            if(0 == strcmp(node->name, name)) {
-                ret = node;
-                break;
-            }
-        }
+    if((NULL != pool)
+        && (NULL != pool->free)
+        && (name_size <= pool->max_name_size)) {
+
+        command = pool->free;
+        pool->free = command->next;
+        ++pool->taken;
     }
 
-    return ret;
+    return command;
 }
 
-static struct ecdc_command *
-get_last_command(struct ecdc_console * console)
+static void
+pool_release(struct command_pool * pool, struct ecdc_command * command)
+{
+    command->next = pool->free;
+    pool->free = command;
+}
+
+// Gives back a command from pool_take. Once the console is gone, the slot is
+// not reused, and the pool goes with its last command
+static void
+pool_return(struct command_pool * pool, struct ecdc_command * command)
 {
-    struct ecdc_command * last_command = NULL;
+    --pool->taken;
+    if(!pool->f_orphaned) {
+        pool_release(pool, command);
+    } else if(0 == pool->taken) {
+        free(pool);
+    }
+}
 
-    if(NULL != console) {
-        for(last_command = console->root;
-            NULL != last_command;
-            last_command = last_command->next) {
 
-            if(NULL == last_command->next) {
-                break;
-            }
+// ---------------------- Command index
+
+static bool
+index_search(struct ecdc_console * console,
+             const char * name,
+             size_t * position)
+{
+    size_t low = 0;
+    size_t high = console->index_count;
+
+    while(low < high) {
+        size_t mid = low + ((high - low) / 2);
+        int cmp = strcmp(console->index[mid]->name, name);
+        if(0 == cmp) {
+            *position = mid;
+            return true;
+        } else if(cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
         }
     }
 
-    return last_command;
+    *position = low;
+    return false;
 }
 
-static struct ecdc_command *
-get_previous_command(struct ecdc_command * command)
+static void
+index_invalidate(struct ecdc_console * console)
 {
-    struct ecdc_command * prev = NULL;
-    do {
-        if(NULL == command) {
-            break;
-        }
+    // An index in caller provided storage is kept, so that it can be used
+    // again once the console is empty
+    if(NULL == console->arena.base) {
+        free(console->index);
+        console->index = NULL;
+        console->index_size = 0;
+    }
+    console->index_count = 0;
+    console->f_index_valid = false;
+}
 
-        struct ecdc_console * console = command->console;
-        if(NULL == console) {
-            break;
-        }
+static void
+index_insert(struct ecdc_console * console,
+             struct ecdc_command * command)
+{
+    if(!console->f_index_valid) {
+        return;
+    }
 
-        if(console->root == command) {
-            break;
+    if(console->index_count == console->index_size) {
+        if(NULL != console->arena.base) {
+            // Fixed size index
+            index_invalidate(console);
+            return;
         }
 
-        struct ecdc_command * node = NULL;
-        for(node = console->root; node != NULL; node = node->next) {
-            if(command == node->next) {
-                prev = node;
-                break;
-            }
+        size_t new_size = (0 == console->index_size)
+            ? INITIAL_INDEX_SIZE
+            : (console->index_size * 2);
+
+        struct ecdc_command ** new_index = (struct ecdc_command **)
+            realloc(console->index, new_size * sizeof(struct ecdc_command *));
+        if(NULL == new_index) {
+            index_invalidate(console);
+            return;
         }
 
-    } while(0);
+        console->index = new_index;
+        console->index_size = new_size;
+    }
+
+    size_t position;
+    (void) index_search(console, command->name, &position);
 
-    return prev;
+    memmove(&console->index[position + 1],
+            &console->index[position],
+            (console->index_count - position) * sizeof(struct ecdc_command *));
+    console->index[position] = command;
+    ++console->index_count;
 }
 
 static void
-register_command(struct ecdc_console * console,
-                 struct ecdc_command * command)
+index_revalidate_if_empty(struct ecdc_console * console)
 {
-    if(NULL != console) {
-        command->console = console;
-        command->next = NULL;
-
-        struct ecdc_command * last_command = get_last_command(console);
-        if(NULL == last_command) {
-            console->root = command;
-        }
-        else {
-            last_command->next = command;
-        }
+    if(NULL == console->root) {
+        // Nothing left to index, so an empty index is valid again
+        console->index_count = 0;
+        console->f_index_valid = true;
     }
 }
 
 static void
-unregister_command(struct ecdc_command * command)
+index_remove(struct ecdc_console * console,
+             struct ecdc_command * command)
 {
-    do {
-        if(NULL == command) {
-            break;
-        }
+    if(!console->f_index_valid) {
+        index_revalidate_if_empty(console);
+        return;
+    }
 
-        struct ecdc_console * console = command->console;
-        if(NULL == console) {
-            break;
-        }
+    size_t position;
+    if(index_search(console, command->name, &position)
+        && (command == console->index[position])) {
 
-        if(console->root == command) {
-            console->root = command->next;
-        }
-        else {
-            struct ecdc_command * prev = get_previous_command(command);
-            if(NULL != prev)
-            {
-                prev->next = command->next;
-            }
+        --console->index_count;
+        memmove(&console->index[position],
+                &console->index[position + 1],
+                (console->index_count - position) * sizeof(struct ecdc_command *));
+    }
+}
+
+
+// -------------------- Shared registry
+
+#if ECDC_ENABLE_REGISTRY
+static const struct registry_entry *
+snapshot_search(const struct registry_snapshot * snapshot,
+                const char * name,
+                size_t * position)
+{
+    size_t low = 0;
+    size_t high = (NULL != snapshot) ? snapshot->count : 0;
+
+    while(low < high) {
+        size_t mid = low + ((high - low) / 2);
+        int cmp = strcmp(snapshot->entries[mid].name, name);
+        if(0 == cmp) {
+            *position = mid;
+            return &snapshot->entries[mid];
+        } else if(cmp < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
         }
+    }
 
-        command->console = NULL;
-        command->next = NULL;
-    } while(0);
+    *position = low;
+    return NULL;
 }
 
-static char *
-find_first_non_whitesapce(char * str)
+static void
+snapshot_append(struct registry_snapshot * snapshot,
+                char ** name_storage,
+                const struct registry_entry * entry)
 {
-    char * out_ptr = NULL;
-    if(str == NULL) {
-        goto out;
-    }
+    size_t name_size = strlen(entry->name) + 1;
+    memcpy(*name_storage, entry->name, name_size);
 
-    while(*str != '\0') {
-        switch(*str) {
-            case '\x20':
-            case '\x09':
-            case '\x0A':
-            case '\x0B':
-            case '\x0C':
-            case '\x0D':
-                ++str;
-                break;
-            default:
-                out_ptr = str;
-                goto out;
-        }
-    }
+    struct registry_entry * new_entry = &snapshot->entries[snapshot->count];
+    new_entry->name = *name_storage;
+    new_entry->callback = entry->callback;
+    new_entry->hint = entry->hint;
+    ++snapshot->count;
 
-    out:
-        return out_ptr;
+    *name_storage += name_size;
 }
 
-static char *
-find_fist_whitespace(char * str)
+// Copies old into a new snapshot, with add inserted or the entry at
+// remove_position left out
+static struct registry_snapshot *
+snapshot_copy(const struct registry_snapshot * old,
+              const struct registry_entry * add,
+              size_t position,
+              bool remove)
 {
-    char * out_ptr = NULL;
-    if(str == NULL) {
-        goto out;
-    }
+    size_t old_count = (NULL != old) ? old->count : 0;
+    size_t count = old_count;
+    size_t names_size = 0;
 
-    while(*str != '\0') {
-        switch(*str) {
-            case '\x20':
-            case '\x09':
-            case '\x0A':
-            case '\x0B':
-            case '\x0C':
-            case '\x0D':
-                out_ptr = str;
-                goto out;
-            default:
-                ++str;
-                break;
+    size_t i;
+    for(i = 0; i < old_count; ++i) {
+        if(!(remove && (i == position))) {
+            names_size += strlen(old->entries[i].name) + 1;
         }
     }
+    if(NULL != add) {
+        names_size += strlen(add->name) + 1;
+        ++count;
+    } else if(remove) {
+        --count;
+    }
 
-    out:
-        return out_ptr;
-}
+    struct registry_snapshot * snapshot = (struct registry_snapshot *)
+        malloc(sizeof(struct registry_snapshot)
+               + (count * sizeof(struct registry_entry))
+               + names_size);
+    if(NULL == snapshot) {
+        return NULL;
+    }
 
+    snapshot->next_retired = NULL;
+    snapshot->count = 0;
+    char * name_storage = (char *) &snapshot->entries[count];
 
-// --------------------------------------------------------- Terminal functions
+    for(i = 0; i <= old_count; ++i) {
+        if((NULL != add) && (i == position)) {
+            snapshot_append(snapshot, &name_storage, add);
+        }
+        if((i < old_count) && !(remove && (i == position))) {
+            snapshot_append(snapshot, &name_storage, &old->entries[i]);
+        }
+    }
 
-// ---------------------------- Newline
+    return snapshot;
+}
 
-static void
-term_put_ansi_newline(struct ecdc_console * console)
+static bool
+registry_is_hazard(struct ecdc_registry * registry,
+                   struct registry_snapshot * snapshot)
 {
-    const char * newline_seq = "\r\n";
-    console->puts(console->hint, newline_seq, 2);
+    size_t i;
+    for(i = 0; i < registry->reader_count; ++i) {
+        if(snapshot == PTR_LOAD_SEQ_CST(&registry->readers[i].r.hazard)) {
+            return true;
+        }
+    }
+    return false;
 }
 
-static inline void
-term_put_newline(struct ecdc_console * console)
+// Frees retired snapshots that no reader is using. Called with the write lock
+static void
+registry_reclaim(struct ecdc_registry * registry)
 {
-    switch(console->mode) {
-        case ECDC_MODE_ANSI:
-        default:
-            term_put_ansi_newline(console);
-            break;
+    struct registry_snapshot ** link = &registry->retired;
+    while(NULL != *link) {
+        struct registry_snapshot * snapshot = *link;
+        if(registry_is_hazard(registry, snapshot)) {
+            link = &snapshot->next_retired;
+        } else {
+            *link = snapshot->next_retired;
+            free(snapshot);
+        }
     }
 }
 
+// Swaps in a new snapshot. Called with the write lock
+static void
+registry_publish(struct ecdc_registry * registry,
+                 struct registry_snapshot * snapshot)
+{
+    struct registry_snapshot * old = (struct registry_snapshot *)
+        PTR_LOAD_ACQUIRE(&registry->current);
+    PTR_STORE_SEQ_CST(&registry->current, snapshot);
 
-// -------------------------- Backspace
+    if(NULL != old) {
+        old->next_retired = registry->retired;
+        registry->retired = old;
+    }
+    registry_reclaim(registry);
+}
 
-static inline void
-term_backspace_ansi(struct ecdc_console * console)
+static const struct registry_snapshot *
+registry_read_lock(struct ecdc_console * console)
 {
-    const char * backspace_seq = "\x08\x20\x08"; // BS, SP, BS
-    console->puts(console->hint, backspace_seq, 3);
+    struct ecdc_registry * registry = console->registry;
+    atomic_ptr_t * hazard = &registry->readers[console->registry_slot].r.hazard;
+
+    // Publish the snapshot, then make sure it is still current. Once that
+    // holds, a writer will see the hazard before it can free the snapshot
+    void * snapshot;
+    do {
+        snapshot = PTR_LOAD_ACQUIRE(&registry->current);
+        PTR_STORE_SEQ_CST(hazard, snapshot);
+    } while(snapshot != PTR_LOAD_SEQ_CST(&registry->current));
+
+    return (const struct registry_snapshot *) snapshot;
 }
 
-static inline void
-term_backspace(struct ecdc_console * console)
+static void
+registry_read_unlock(struct ecdc_console * console)
 {
-    switch(console->mode) {
-        case ECDC_MODE_ANSI:
-        default:
-            term_backspace_ansi(console);
-            break;
-    }
+    struct ecdc_registry * registry = console->registry;
+    PTR_STORE_RELEASE(&registry->readers[console->registry_slot].r.hazard, NULL);
 }
+#endif /* ECDC_ENABLE_REGISTRY */
 
 
-//------------------- Character writing
+// ----------------------- Command list
 
-static void
-term_puts(struct ecdc_console * console, const char * str)
+static struct ecdc_command *
+locate_command(struct ecdc_console * console,
+               const char * name)
 {
-    if(NULL == str) {
-        return;
-    }
+    struct ecdc_command * ret = NULL;
 
-    while(*str != '\0') {
-        bool seq_end_with_nl = false;
-        bool seq_end_with_bs = false;
-
-        const char * end_seq;
-        for(end_seq = str; *end_seq != '\0'; ++end_seq) {
-            if('\n' == *end_seq) {
-                seq_end_with_nl = true;
-                break;
-            } else if('\x08' == *end_seq) {
-                seq_end_with_bs = true;
-                break;
+    if(NULL != console) {
+        if(console->f_index_valid) {
+            size_t position;
+            if(index_search(console, name, &position)) {
+                ret = console->index[position];
+            }
+        } else {
+            struct ecdc_command * node = NULL;
+            for(node = console->root; NULL != node; node = node->next) {
+                if(0 == strcmp(node->name, name)) {
+                    ret = node;
+                    break;
+                }
             }
         }
+    }
 
-        if(end_seq != str) {
-            size_t seq_len = end_seq - str;
-            console->puts(console->hint, str, seq_len);
-            str = end_seq;
-        }
+    return ret;
+}
 
-        if(seq_end_with_nl) {
-            term_put_newline(console);
-            ++str;
-        } else if(seq_end_with_bs) {
-            term_backspace(console);
-            ++str;
+static const struct ecdc_static_command *
+locate_static_command(const char * name)
+{
+    const struct ecdc_static_command * ret = NULL;
+
+    // The linker doesn't sort the table, so this is a linear walk. Comparing
+    // the lengths first keeps it to one strlen and very few string compares
+    size_t name_length = strlen(name);
+
+    const struct ecdc_static_command * node;
+    for(node = STATIC_COMMANDS_BEGIN; node < STATIC_COMMANDS_END; ++node) {
+        if((name_length == node->name_length)
+            && (0 == memcmp(node->name, name, name_length))) {
+            ret = node;
+            break;
         }
     }
+
+    return ret;
 }
 
-static inline void
-term_putc(struct ecdc_console * console, char c)
+static void
+list_append(struct ecdc_console * console,
+            struct ecdc_command * command)
 {
-    if('\n' == c) {
-        term_put_newline(console);
-    } else if('\x08' == c) {
-        term_backspace(console);
+    command->console = console;
+    command->next = NULL;
+    command->prev = console->tail;
+
+    if(NULL == console->tail) {
+        console->root = command;
     } else {
-        console->puts(console->hint, &c, 1);
+        console->tail->next = command;
     }
+    console->tail = command;
 }
 
-static inline void
-term_puts_raw(struct ecdc_console * console, const char * s, size_t len)
+static void
+list_unlink(struct ecdc_console * console,
+            struct ecdc_command * command)
 {
-    console->puts(console->hint, s, len);
+    if(NULL == command->prev) {
+        console->root = command->next;
+    } else {
+        command->prev->next = command->next;
+    }
+
+    if(NULL == command->next) {
+        console->tail = command->prev;
+    } else {
+        command->next->prev = command->prev;
+    }
+
+    command->console = NULL;
+    command->next = NULL;
+    command->prev = NULL;
 }
 
-static inline void
-term_putc_raw(struct ecdc_console * console, char c)
+static void
+register_command(struct ecdc_console * console,
+                 struct ecdc_command * command)
 {
-    console->puts(console->hint, &c, 1);
+    if(NULL != console) {
+        list_append(console, command);
+        index_insert(console, command);
+    }
 }
 
+static void
+unregister_command(struct ecdc_command * command)
+{
+    do {
+        if(NULL == command) {
+            break;
+        }
+
+        struct ecdc_console * console = command->console;
+        if(NULL == console) {
+            break;
+        }
 
-// ------------------ Character reading
+        list_unlink(console, command);
+        index_remove(console, command);
 
-static inline int
-term_getc_raw(struct ecdc_console * console)
-{
-    int ret = console->snoop_char;
-    console->snoop_char = ECDC_GETC_EOF;
+        // A running command is dropped, the console moves on next pump
+        if(command == console->running) {
+            console->running = NULL;
+        }
+    } while(0);
+}
 
-    if(ECDC_GETC_EOF == ret) {
-        ret = console->getc(console->hint);
+static void
+release_command(struct ecdc_command * command)
+{
+    switch(command->storage) {
+        case COMMAND_STORAGE_HEAP:
+            free(command);
+            break;
+        case COMMAND_STORAGE_POOL:
+            pool_return(command->pool, command);
+            break;
+        case COMMAND_STORAGE_CALLER:
+        default:
+            break;
     }
+}
 
-    return ret;
+// --------------------- Command history
+
+static size_t
+history_wrap(const struct history * history, size_t position)
+{
+    return (position >= history->size) ? (position - history->size) : position;
 }
 
-static inline void
-term_set_snoop_char(struct ecdc_console * console, char c)
+static size_t
+history_get_length(const struct history * history, size_t position)
 {
-    console->snoop_char = c;
+    const unsigned char * data = (const unsigned char *) history->data;
+    return (size_t) data[position]
+        | ((size_t) data[history_wrap(history, position + 1)] << 8);
 }
 
+static void
+history_put_length(struct history * history, size_t position, size_t length)
+{
+    history->data[position] = (char) (length & 0xFF);
+    history->data[history_wrap(history, position + 1)] = (char) (length >> 8);
+}
 
-// ---------------------------------------------------- State machine functions
+static size_t
+history_next(const struct history * history, size_t position)
+{
+    size_t length = history_get_length(history, position);
+    return history_wrap(history, position + length + HISTORY_FRAME_SIZE);
+}
 
-static void
-state_start_new_command(struct ecdc_console * console);
+static size_t
+history_previous(const struct history * history, size_t position)
+{
+    size_t trailer = history_wrap(history,
+        position + history->size - HISTORY_LENGTH_SIZE);
+    size_t length = history_get_length(history, trailer);
+    return history_wrap(history,
+        position + history->size - (length + HISTORY_FRAME_SIZE));
+}
 
+// Adds a line. Separators in the line are stored as spaces
 static void
-state_read_input(struct ecdc_console * console);
+history_add(struct history * history, const char * line, size_t length)
+{
+    size_t entry_size = length + HISTORY_FRAME_SIZE;
+    if((0 == length)
+        || (length > HISTORY_MAX_ENTRY_LENGTH)
+        || (entry_size > history->size))
+    {
+        return;
+    }
+
+    while((history->size - history->used) < entry_size) {
+        size_t oldest_size = history_get_length(history, history->tail)
+            + HISTORY_FRAME_SIZE;
+        history->tail = history_wrap(history, history->tail + oldest_size);
+        history->used -= oldest_size;
+    }
 
+    size_t position = history->head;
+    history_put_length(history, position, length);
+    position = history_wrap(history, position + HISTORY_LENGTH_SIZE);
 
-static void
-state_parse_escape_sequence_ansi(struct ecdc_console * console)
+    size_t i;
+    for(i = 0; i < length; ++i) {
+        history->data[position] = ('\0' == line[i]) ? ' ' : line[i];
+        position = history_wrap(history, position + 1);
+    }
+
+    history_put_length(history, position, length);
+    history->head = history_wrap(history, position + HISTORY_LENGTH_SIZE);
+    history->used += entry_size;
+}
+
+// Moves the cursor to an older entry. Returns false if there is none
+static bool
+history_older(struct history * history)
 {
-    // TODO: Stub
-    // This would be a great spot to handle arrow keys
-    console->state = state_read_input;
+    if(0 == history->used) {
+        return false;
+    }
+
+    if(!history->f_browsing) {
+        history->cursor = history_previous(history, history->head);
+        history->f_browsing = true;
+    } else if(history->cursor != history->tail) {
+        history->cursor = history_previous(history, history->cursor);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Moves the cursor to a newer entry, or stops browsing past the newest.
+// Returns false if the cursor didn't move
+static bool
+history_newer(struct history * history)
+{
+    if(!history->f_browsing) {
+        return false;
+    }
+
+    size_t next = history_next(history, history->cursor);
+    if(next == history->head) {
+        history->f_browsing = false;
+    } else {
+        history->cursor = next;
+    }
+    return true;
+}
+
+
+// ---------------------- Prefix search
+
+// A command whose name starts with a prefix
+// Console commands also have their command, which is NULL for the others
+struct candidate {
+    const char *                        name;
+    ecdc_callback_fn                    callback;
+    void *                              hint;
+    struct ecdc_command *               command;
+};
+
+typedef void (*candidate_fn)(struct ecdc_console * console,
+                             const struct candidate * candidate,
+                             void * context);
+
+// Registry commands can only be used while the registry is read locked
+struct registry_snapshot;
+
+static const struct registry_snapshot *
+candidates_lock(struct ecdc_console * console)
+{
+    #if ECDC_ENABLE_REGISTRY
+    if(NULL != console->registry) {
+        return registry_read_lock(console);
+    }
+    #endif /* ECDC_ENABLE_REGISTRY */
+
+    (void) console;
+    return NULL;
 }
 
 static void
-state_read_escape_sequence(struct ecdc_console * console)
+candidates_unlock(struct ecdc_console * console)
 {
-    bool abort_sequence = false;
-    bool parse_sequence = false;
+    #if ECDC_ENABLE_REGISTRY
+    if(NULL != console->registry) {
+        registry_read_unlock(console);
+    }
+    #endif /* ECDC_ENABLE_REGISTRY */
 
-    int loop_limit;
-    for(loop_limit = 0; loop_limit < 8; ++loop_limit)
-    {
-        int new_char = term_getc_raw(console);
-        if(ECDC_GETC_EOF == new_char) {
-            break;
-        }
+    (void) console;
+}
 
-        char in = new_char;
+// Calls fn for every command that starts with prefix, in dispatch order. The
+// command index and the registry are sorted, so their matches are a single
+// run found with a binary search. The static table isn't sorted, and is
+// walked
+static void
+for_each_candidate(struct ecdc_console * console,
+                   const struct registry_snapshot * snapshot,
+                   const char * prefix,
+                   candidate_fn fn,
+                   void * context)
+{
+    size_t prefix_length = strlen(prefix);
+    struct candidate candidate;
 
-        if(('\x18' == in) || ('\x1A' == in)) {
-            // CAN or SUB
-            abort_sequence = true;
-            break;
-        } else if(console->cs_write_index < CS_BUFFER_SIZE) {
-            console->cs_buffer[console->cs_write_index] = in;
-            size_t index = console->cs_write_index;
-            ++console->cs_write_index;
+    if(console->f_index_valid) {
+        size_t position;
+        (void) index_search(console, prefix, &position);
 
-            if(1 == index) {
-                if('[' == in) {
-                    // Control sequence introducer, this will be a 3 or more
-                    // character sequence
-                } else if(('\x40' <= in) && ('\x5F' >= in)) {
-                    // End of a two character escape sequence
-                    parse_sequence = true;
-                    break;
-                }
-            } else if(1 < index) {
-                if(('\x40' <= in) && ('\x7E' >= in)) {
-                    // End of a multi character sequence
-                    parse_sequence = true;
-                    break;
-                }
+        for(; position < console->index_count; ++position) {
+            struct ecdc_command * command = console->index[position];
+            if(0 != strncmp(command->name, prefix, prefix_length)) {
+                break;
+            }
+
+            candidate.name = command->name;
+            candidate.callback = command->callback;
+            candidate.hint = command->hint;
+            candidate.command = command;
+            fn(console, &candidate, context);
+        }
+    } else {
+        struct ecdc_command * command;
+        for(command = console->root; NULL != command; command = command->next) {
+            if(0 == strncmp(command->name, prefix, prefix_length)) {
+                candidate.name = command->name;
+                candidate.callback = command->callback;
+                candidate.hint = command->hint;
+                candidate.command = command;
+                fn(console, &candidate, context);
             }
-        } else {
-            // Dump the sequence, parsing it would be meaningless
-            term_set_snoop_char(console, in);
-            abort_sequence = true;
-            break;
         }
     }
 
-    if(abort_sequence) {
-        size_t i;
-        for(i = 0; i < console->cs_write_index; ++i) {
-            term_putc_raw(console, console->cs_buffer[i]);
-        }
-        console->cs_write_index = 0;
-        console->state = state_read_input;
-    } else if(parse_sequence) {
-        switch(console->mode) {
-            case ECDC_MODE_ANSI:
-            default:
-                console->state = state_parse_escape_sequence_ansi;
+    #if ECDC_ENABLE_REGISTRY
+    if(NULL != snapshot) {
+        size_t position;
+        (void) snapshot_search(snapshot, prefix, &position);
+
+        for(; position < snapshot->count; ++position) {
+            const struct registry_entry * entry = &snapshot->entries[position];
+            if(0 != strncmp(entry->name, prefix, prefix_length)) {
                 break;
+            }
+
+            candidate.name = entry->name;
+            candidate.callback = entry->callback;
+            candidate.hint = entry->hint;
+            candidate.command = NULL;
+            fn(console, &candidate, context);
+        }
+    }
+    #else
+    (void) snapshot;
+    #endif /* ECDC_ENABLE_REGISTRY */
+
+    const struct ecdc_static_command * static_command;
+    for(static_command = STATIC_COMMANDS_BEGIN;
+        static_command < STATIC_COMMANDS_END;
+        ++static_command) {
+
+        if(0 == strncmp(static_command->name, prefix, prefix_length)) {
+            candidate.name = static_command->name;
+            candidate.callback = static_command->callback;
+            candidate.hint = static_command->hint;
+            candidate.command = NULL;
+            fn(console, &candidate, context);
         }
     }
 }
 
+// Summary of the commands that start with a prefix
+struct completion {
+    struct candidate                    first;
+    size_t                              count;
+    size_t                              common_length;
+};
+
 static void
-state_parse_input(struct ecdc_console * console)
+completion_add(struct ecdc_console * console,
+               const struct candidate * candidate,
+               void * context)
 {
-    // Split
-    size_t argc = 0;
-    {
-        char * arg_line = console->arg_line;
-        arg_line[console->arg_line_write_index] = '\0';
+    (void) console;
+
+    struct completion * completion = (struct completion *) context;
 
+    if(0 == completion->count) {
+        completion->first = *candidate;
+        completion->common_length = strlen(candidate->name);
+        completion->count = 1;
+    } else if(0 != strcmp(completion->first.name, candidate->name)) {
+        // A name that is shadowed by an earlier one doesn't count
         size_t i = 0;
-        for(; i < console->max_argc; ++i) {
-            char * start = find_first_non_whitesapce(arg_line);
-            if(NULL == start) {
-                // Reached the \0 at the end of the string
-                break;
-            }
+        while((i < completion->common_length)
+            && (completion->first.name[i] == candidate->name[i])) {
+            ++i;
+        }
+        completion->common_length = i;
+        ++completion->count;
+    }
+}
 
-            console->argv[i] = start;
-            argc = i + 1;
 
-            char * stop = find_fist_whitespace(start);
-            if(NULL == stop) {
-                // Reached the \0 at the end of the string
-                break;
-            }
-            *stop = '\0';
-            arg_line = stop + 1;
+// ------------------------------ Trace
+
+#if ECDC_ENABLE_TRACE
+static void
+trace_record(struct ecdc_console * console,
+             enum ecdc_trace_event event,
+             unsigned int payload)
+{
+    struct trace_ring * ring = console->trace;
+    size_t head = RING_LOAD_RELAXED(&ring->head);
+    struct ecdc_trace_entry * entry = &ring->entries[head & ring->mask];
+
+    entry->timestamp = (NULL != console->trace_clock)
+        ? console->trace_clock(console->hint)
+        : 0;
+    entry->state = (void (*)(void)) console->state;
+    entry->event = (unsigned short) event;
+    entry->payload = (unsigned short) payload;
+
+    RING_STORE_RELEASE(&ring->head, head + 1);
+}
+#endif /* ECDC_ENABLE_TRACE */
+
+
+// -------------------------- Tokenizer
+
+// Character classes for splitting. Anything that isn't listed is part of an
+// argument. Separators are space, \t, \n, \v, \f and \r
+enum char_class {
+    CHAR_ARGUMENT = 0,
+    CHAR_SEPARATOR,
+    CHAR_END,
+};
+
+static const unsigned char char_classes[256] = {
+    ['\0']   = CHAR_END,
+    ['\x09'] = CHAR_SEPARATOR, ['\x0A'] = CHAR_SEPARATOR,
+    ['\x0B'] = CHAR_SEPARATOR, ['\x0C'] = CHAR_SEPARATOR,
+    ['\x0D'] = CHAR_SEPARATOR, ['\x20'] = CHAR_SEPARATOR,
+};
+
+#define CHAR_CLASS(c)   (char_classes[(unsigned char) (c)])
+
+// Printable characters, space included, need nothing but storing and echo.
+// When a block of input is buffered, runs of them are taken at once and split
+// a word at a time. A word holds only printable characters when no byte is
+// below 0x20 or above 0x7E, and a word of them holds no space when no byte is
+// below 0x21
+#define SWAR_ONES       ((uint64_t) 0x0101010101010101ull)
+#define SWAR_HIGHS      ((uint64_t) 0x8080808080808080ull)
+#define SWAR_HAS_LESS_THAN(x, n) \
+    ((((x) - (SWAR_ONES * (n))) & ~(x) & SWAR_HIGHS) != 0)
+#define SWAR_HAS_MORE_THAN(x, n) \
+    (((((x) + (SWAR_ONES * (127 - (n)))) | (x)) & SWAR_HIGHS) != 0)
+
+static inline uint64_t
+load_word(const char * s)
+{
+    uint64_t word;
+    memcpy(&word, s, sizeof(word));
+    return word;
+}
+
+static inline bool
+is_printable(char c)
+{
+    unsigned char u = (unsigned char) c;
+    return (0x20 <= u) && (0x7F > u);
+}
+
+// Length of the run of printable characters at the start of s
+static inline size_t
+printable_run_length(const char * s, size_t len)
+{
+    size_t i = 0;
+    while((len - i) >= sizeof(uint64_t)) {
+        uint64_t word = load_word(&s[i]);
+        if(SWAR_HAS_LESS_THAN(word, 0x20) || SWAR_HAS_MORE_THAN(word, 0x7E)) {
+            break;
         }
+        i += sizeof(uint64_t);
     }
 
-    // Clear the rest of argv
-    {
-        size_t i;
-        for(i = argc; i < console->max_argc; ++i) {
-            console->argv[i] = NULL;
-        }
+    while((i < len) && is_printable(s[i])) {
+        ++i;
     }
+    return i;
+}
 
-    // Search for handler
-    if(argc > 0) {
-        struct ecdc_command * command = locate_command(console, console->argv[0]);
-        if(NULL != command) {
-            // Found
-            command->callback(command->hint, argc, console->argv);
-        } else {
-            term_puts(console, "'");
-            term_puts(console, console->argv[0]);
-            term_puts(console, "' not found\n");
+// The argument line is kept terminated, and separators are stored as '\0'.
+// That way every argument in argv is a string while the line is typed, and
+// nothing is left to do when it completes. Arguments past max_argc are
+// ignored
+static bool
+arg_line_append(struct ecdc_console * console, char c)
+{
+    size_t idx = console->arg_line_write_index;
+    if(idx >= console->arg_line_size) {
+        console->f_line_overflow = true;
+        STATS_INC(console, overflow_drops);
+        TRACE(console, ECDC_TRACE_OVERFLOW, (unsigned char) c);
+        return false;
+    }
+
+    char * arg_line = console->arg_line;
+    if(CHAR_CLASS(c) != CHAR_ARGUMENT) {
+        arg_line[idx] = '\0';
+    } else {
+        // Start of a new argument
+        if(((0 == idx) || ('\0' == arg_line[idx - 1]))
+            && (console->argc < console->max_argc))
+        {
+            console->argv[console->argc++] = &arg_line[idx];
         }
+        arg_line[idx] = c;
     }
 
-    console->state = state_start_new_command;
+    console->arg_line_write_index = idx + 1;
+    arg_line[idx + 1] = '\0';
+    return true;
 }
 
+// Runs shorter than this are split a character at a time. Their arguments are
+// too short for the word at a time copy to make up for its setup
+#define ARG_LINE_WORD_RUN_MIN   64
+
+// Appends a run of characters from printable_run_length, all at once. The run
+// must fit in the argument line. In long runs, arguments are copied a word at
+// a time until a word holds a space
 static void
-state_read_input(struct ecdc_console * console)
+arg_line_append_run(struct ecdc_console * console, const char * s, size_t len)
 {
-    int loop_limit;
-    for(loop_limit = 0; loop_limit < 8; ++loop_limit)
-    {
-        int new_char = term_getc_raw(console);
-        if(ECDC_GETC_EOF == new_char) {
-            break;
-        }
+    char * arg_line = &console->arg_line[console->arg_line_write_index];
+    bool f_separated = (0 == console->arg_line_write_index)
+        || ('\0' == arg_line[-1]);
 
-        bool local_echo = false;
+    if(len < ARG_LINE_WORD_RUN_MIN) {
+        // Kept in locals, the stores to the line could alias them
+        const char ** argv = console->argv;
+        size_t argc = console->argc;
+        size_t max_argc = console->max_argc;
 
-        char in = new_char;
-        if('\r' == in) {
-            term_put_newline(console);
-            console->state = state_parse_input;
-            break;
+        size_t i;
+        for(i = 0; i < len; ++i) {
+            bool f_space = (' ' == s[i]);
+            arg_line[i] = f_space ? '\0' : s[i];
+
+            // Start of a new argument
+            if(f_separated && !f_space && (argc < max_argc)) {
+                argv[argc++] = &arg_line[i];
+            }
+            f_separated = f_space;
+        }
+
+        console->argc = argc;
+    } else {
+        size_t i = 0;
+        while(i < len) {
+            if(' ' == s[i]) {
+                arg_line[i] = '\0';
+                f_separated = true;
+                ++i;
+                continue;
+            }
+
+            // Start of a new argument
+            if(f_separated && (console->argc < console->max_argc)) {
+                console->argv[console->argc++] = &arg_line[i];
+            }
+            f_separated = false;
+
+            while((len - i) >= sizeof(uint64_t)) {
+                uint64_t word = load_word(&s[i]);
+                if(SWAR_HAS_LESS_THAN(word, 0x21)) {
+                    break;
+                }
+                memcpy(&arg_line[i], &word, sizeof(word));
+                i += sizeof(uint64_t);
+            }
+
+            while((i < len) && (' ' != s[i])) {
+                arg_line[i] = s[i];
+                ++i;
+            }
+        }
+    }
+
+    console->arg_line_write_index += len;
+    arg_line[len] = '\0';
+}
+
+static bool
+arg_line_backspace(struct ecdc_console * console)
+{
+    size_t idx = console->arg_line_write_index;
+    if(0 == idx) {
+        return false;
+    }
+
+    --idx;
+    char * arg_line = console->arg_line;
+
+    // Removing the first character of an argument removes the argument
+    if((console->argc > 0)
+        && (&arg_line[idx] == console->argv[console->argc - 1]))
+    {
+        console->argv[--console->argc] = NULL;
+    }
+
+    console->arg_line_write_index = idx;
+    arg_line[idx] = '\0';
+    return true;
+}
+
+static void
+arg_line_clear(struct ecdc_console * console)
+{
+    size_t i;
+    for(i = 0; i < console->argc; ++i) {
+        console->argv[i] = NULL;
+    }
+    console->argc = 0;
+
+    console->arg_line_write_index = 0;
+    console->arg_line[0] = '\0';
+    console->f_line_overflow = false;
+}
+
+
+// -------------------------------- CRC
+
+// CRC-16/XMODEM, polynomial 0x1021 and initial value 0, a nibble at a time.
+// Running it over a message followed by its CRC, high byte first, gives 0
+static const uint16_t crc16_nibbles[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+static uint16_t
+crc16_update(uint16_t crc, const char * s, size_t len)
+{
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        unsigned int c = (unsigned char) s[i];
+        crc = (uint16_t) ((crc << 4) ^ crc16_nibbles[(crc >> 12) ^ (c >> 4)]);
+        crc = (uint16_t) ((crc << 4) ^ crc16_nibbles[(crc >> 12) ^ (c & 0xF)]);
+    }
+    return crc;
+}
+
+// SLIP framing characters, see RFC 1055
+#define FRAME_END                       ((char) ECDC_FRAME_END)
+#define FRAME_ESC                       ((char) ECDC_FRAME_ESC)
+#define FRAME_ESC_END                   ((char) 0xDC)
+#define FRAME_ESC_ESC                   ((char) 0xDD)
+
+#define FRAME_ID_SIZE                   2
+#define FRAME_CRC_SIZE                  2
+
+// Adds output to the CRC of the response being sent in framed mode
+static inline void
+frame_checksum(struct ecdc_console * console, const char * s, size_t len)
+{
+    if(ECDC_MODE_FRAMED == console->mode) {
+        console->frame_tx_crc = crc16_update(console->frame_tx_crc, s, len);
+    }
+}
+
+
+// --------------------------- Profiler
+
+#if ECDC_ENABLE_PROFILER
+static void
+profile_record(struct ecdc_profile * profile, unsigned long cycles)
+{
+    ++profile->calls;
+    profile->total_cycles += cycles;
+    if(cycles > profile->max_cycles) {
+        profile->max_cycles = cycles;
+    }
+
+    size_t bucket = 0;
+    unsigned long scaled = cycles >> ECDC_PROFILE_MIN_LOG2;
+    while((scaled > 1) && (bucket < (ECDC_PROFILE_BUCKETS - 1))) {
+        scaled >>= 1;
+        ++bucket;
+    }
+    ++profile->histogram[bucket];
+}
+#endif /* ECDC_ENABLE_PROFILER */
+
+// Calls a console command's callback, timing it when profiling
+static inline void
+command_call(struct ecdc_console * console,
+             struct ecdc_command * command,
+             size_t argc)
+{
+    #if ECDC_ENABLE_PROFILER
+    if(NULL != console->profile_clock) {
+        unsigned long start = console->profile_clock(console->hint);
+        command->callback(command->hint, argc, console->argv);
+        profile_record(&command->profile,
+                       console->profile_clock(console->hint) - start);
+        return;
+    }
+    #endif /* ECDC_ENABLE_PROFILER */
+
+    command->callback(command->hint, argc, console->argv);
+}
+
+// Takes a step of a resumable command, timing it when profiling
+static inline int
+command_step(struct ecdc_console * console, struct ecdc_command * command)
+{
+    #if ECDC_ENABLE_PROFILER
+    if(NULL != console->profile_clock) {
+        unsigned long start = console->profile_clock(console->hint);
+        int ret = command->resumable(command->hint,
+                                     &console->running_state,
+                                     console->running_argc,
+                                     console->argv);
+        profile_record(&command->profile,
+                       console->profile_clock(console->hint) - start);
+        return ret;
+    }
+    #endif /* ECDC_ENABLE_PROFILER */
+
+    return command->resumable(command->hint,
+                              &console->running_state,
+                              console->running_argc,
+                              console->argv);
+}
+
+
+// --------------------------------------------------------- Terminal functions
+
+// ------------------------ Output queue
+
+// Writes as much of the queue as the write function accepts
+static void
+tx_queue_drain(struct ecdc_console * console)
+{
+    struct tx_queue * queue = console->tx_queue;
+
+    while(0 < queue->len) {
+        size_t len = queue->size - queue->head;
+        if(len > queue->len) {
+            len = queue->len;
+        }
+
+        size_t accepted = console->write(console->hint,
+                                         &queue->data[queue->head],
+                                         len);
+        if(accepted > len) {
+            accepted = len;
+        }
+        STATS_INC(console, send_calls);
+        STATS_ADD(console, bytes_sent, accepted);
+
+        queue->head += accepted;
+        if(queue->head == queue->size) {
+            queue->head = 0;
+        }
+        queue->len -= accepted;
+
+        if(accepted < len) {
+            break;
+        }
+    }
+}
+
+static void
+tx_queue_push(struct tx_queue * queue, const char * s, size_t len)
+{
+    size_t space = queue->size - queue->len;
+    if(len > space) {
+        queue->dropped += len - space;
+        len = space;
+    }
+
+    size_t tail = queue->head + queue->len;
+    if(tail >= queue->size) {
+        tail -= queue->size;
+    }
+
+    size_t first = queue->size - tail;
+    if(first > len) {
+        first = len;
+    }
+    memcpy(&queue->data[tail], s, first);
+    memcpy(queue->data, &s[first], len - first);
+    queue->len += len;
+}
+
+// Input is held off while the queue is over half full, so that echo and
+// command output have room
+static bool
+tx_queue_is_congested(struct ecdc_console * console)
+{
+    struct tx_queue * queue = console->tx_queue;
+    return (NULL != queue) && (queue->len > (queue->size / 2));
+}
+
+
+// ------------------------ Raw writing
+
+// Hands output to the transport
+static void
+term_transmit(struct ecdc_console * console, const char * s, size_t len)
+{
+    struct tx_queue * queue = console->tx_queue;
+    if(NULL == queue) {
+        console->puts(console->hint, s, len);
+        STATS_INC(console, send_calls);
+        STATS_ADD(console, bytes_sent, len);
+        return;
+    }
+
+    // Queued output goes first
+    tx_queue_drain(console);
+    if(0 == queue->len) {
+        size_t accepted = console->write(console->hint, s, len);
+        if(accepted > len) {
+            accepted = len;
+        }
+        STATS_INC(console, send_calls);
+        STATS_ADD(console, bytes_sent, accepted);
+        s += accepted;
+        len -= accepted;
+    }
+
+    tx_queue_push(queue, s, len);
+}
+
+static void
+term_flush(struct ecdc_console * console)
+{
+    if(0 < console->tx_len) {
+        term_transmit(console, console->tx_buffer, console->tx_len);
+        console->tx_len = 0;
+    }
+}
+
+static void
+term_write(struct ecdc_console * console, const char * s, size_t len)
+{
+    if(0 == len) {
+        return;
+    }
+
+    if(len > (console->tx_buffer_size - console->tx_len)) {
+        term_flush(console);
+    }
+
+    if(len < console->tx_buffer_size) {
+        memcpy(&console->tx_buffer[console->tx_len], s, len);
+        console->tx_len += len;
+    } else {
+        // Doesn't fit (or there is no buffer), write it straight through
+        term_transmit(console, s, len);
+    }
+}
+
+
+// ---------------------------- Newline
+
+static void
+term_put_ansi_newline(struct ecdc_console * console)
+{
+    const char * newline_seq = "\r\n";
+    term_write(console, newline_seq, 2);
+}
+
+static inline void
+term_put_newline(struct ecdc_console * console)
+{
+    switch(console->mode) {
+        case ECDC_MODE_FRAMED:
+            // Sent as is, it never needs escaping
+            frame_checksum(console, "\n", 1);
+            term_write(console, "\n", 1);
+            break;
+
+        case ECDC_MODE_ANSI:
+        default:
+            term_put_ansi_newline(console);
+            break;
+    }
+}
+
+
+// -------------------------- Backspace
+
+static inline void
+term_backspace_ansi(struct ecdc_console * console)
+{
+    const char * backspace_seq = "\x08\x20\x08"; // BS, SP, BS
+    term_write(console, backspace_seq, 3);
+}
+
+static inline void
+term_backspace(struct ecdc_console * console)
+{
+    switch(console->mode) {
+        case ECDC_MODE_FRAMED:
+            // Nothing is echoed
+            break;
+
+        case ECDC_MODE_ANSI:
+        default:
+            term_backspace_ansi(console);
+            break;
+    }
+}
+
+
+//------------------- Character writing
+
+static void
+term_write_translated(struct ecdc_console * console,
+                      const char * s,
+                      size_t len);
+
+static void
+term_puts(struct ecdc_console * console, const char * str)
+{
+    if(NULL == str) {
+        return;
+    }
+
+    if(ECDC_MODE_FRAMED == console->mode) {
+        term_write_translated(console, str, strlen(str));
+        return;
+    }
+
+    while(*str != '\0') {
+        bool seq_end_with_nl = false;
+        bool seq_end_with_bs = false;
+
+        const char * end_seq;
+        for(end_seq = str; *end_seq != '\0'; ++end_seq) {
+            if('\n' == *end_seq) {
+                seq_end_with_nl = true;
+                break;
+            } else if('\x08' == *end_seq) {
+                seq_end_with_bs = true;
+                break;
+            }
+        }
+
+        if(end_seq != str) {
+            size_t seq_len = end_seq - str;
+            term_write(console, str, seq_len);
+            str = end_seq;
+        }
+
+        if(seq_end_with_nl) {
+            term_put_newline(console);
+            ++str;
+        } else if(seq_end_with_bs) {
+            term_backspace(console);
+            ++str;
+        }
+    }
+}
+
+static inline void
+term_putc(struct ecdc_console * console, char c)
+{
+    if(ECDC_MODE_FRAMED == console->mode) {
+        term_write_translated(console, &c, 1);
+    } else if('\n' == c) {
+        term_put_newline(console);
+    } else if('\x08' == c) {
+        term_backspace(console);
+    } else {
+        term_write(console, &c, 1);
+    }
+}
+
+static inline void
+term_puts_raw(struct ecdc_console * console, const char * s, size_t len)
+{
+    term_write(console, s, len);
+}
+
+static inline void
+term_putc_raw(struct ecdc_console * console, char c)
+{
+    term_write(console, &c, 1);
+}
+
+
+// Sequence a character is translated to on output, or NULL if it is written
+// as is
+static const char *
+term_translation(struct ecdc_console * console, char c, size_t * len)
+{
+    switch(console->mode) {
+        case ECDC_MODE_FRAMED:
+            if(FRAME_END == c) {
+                *len = 2;
+                return "\xDB\xDC";
+            } else if(FRAME_ESC == c) {
+                *len = 2;
+                return "\xDB\xDD";
+            }
+            break;
+
+        case ECDC_MODE_ANSI:
+        default:
+            if('\n' == c) {
+                *len = 2;
+                return "\r\n";
+            } else if('\x08' == c) {
+                *len = 3;
+                return "\x08\x20\x08";
+            }
+            break;
+    }
+    return NULL;
+}
+
+// Writes len characters at s with translation
+static void
+term_write_translated(struct ecdc_console * console,
+                      const char * s,
+                      size_t len)
+{
+    frame_checksum(console, s, len);
+
+    size_t start = 0;
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        size_t seq_len;
+        const char * seq = term_translation(console, s[i], &seq_len);
+        if(NULL != seq) {
+            term_write(console, &s[start], i - start);
+            term_write(console, seq, seq_len);
+            start = i + 1;
+        }
+    }
+    term_write(console, &s[start], len - start);
+}
+
+// Writes len characters at s with translation, without going through the
+// staging buffer. This is used for committed output that can't be
+// translated in place
+static void
+term_transmit_translated(struct ecdc_console * console,
+                         const char * s,
+                         size_t len)
+{
+    size_t start = 0;
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        size_t seq_len;
+        const char * seq = term_translation(console, s[i], &seq_len);
+        if(NULL != seq) {
+            if(i > start) {
+                term_transmit(console, &s[start], i - start);
+            }
+            term_transmit(console, seq, seq_len);
+            start = i + 1;
+        }
+    }
+    if(len > start) {
+        term_transmit(console, &s[start], len - start);
+    }
+}
+
+
+// ----------------------------- Prompt
+
+static void
+term_put_prompt(struct ecdc_console * console)
+{
+    if(NULL == console->prompt)
+    {
+        term_puts_raw(console, DEFAULT_PROMPT,
+            sizeof(DEFAULT_PROMPT) / sizeof(*DEFAULT_PROMPT));
+    }
+    else
+    {
+        term_puts(console, console->prompt);
+    }
+}
+
+// Writes the line typed so far. Separators are stored as '\0', and are
+// written as spaces
+static void
+term_put_arg_line(struct ecdc_console * console)
+{
+    size_t i;
+    for(i = 0; i < console->arg_line_write_index; ++i) {
+        char c = console->arg_line[i];
+        term_putc_raw(console, ('\0' == c) ? ' ' : c);
+    }
+}
+
+
+// ---------------------------- Framing
+
+// Starts a response. Everything written until frame_end is its output
+static void
+frame_begin(struct ecdc_console * console, uint16_t id)
+{
+    char header[FRAME_ID_SIZE] = { (char) (id >> 8), (char) id };
+
+    term_putc_raw(console, FRAME_END);
+    console->frame_tx_crc = 0;
+    console->f_frame_open = true;
+    term_write_translated(console, header, FRAME_ID_SIZE);
+}
+
+static void
+frame_end(struct ecdc_console * console, unsigned char status)
+{
+    if(!console->f_frame_open) {
+        return;
+    }
+
+    term_write_translated(console, (const char *) &status, 1);
+
+    uint16_t crc = console->frame_tx_crc;
+    char trailer[FRAME_CRC_SIZE] = { (char) (crc >> 8), (char) crc };
+    term_write_translated(console, trailer, FRAME_CRC_SIZE);
+
+    term_putc_raw(console, FRAME_END);
+    console->f_frame_open = false;
+}
+
+// Output written outside of a command goes out in a response of its own.
+// Returns true if one was started
+static bool
+frame_notify_begin(struct ecdc_console * console)
+{
+    if((ECDC_MODE_FRAMED != console->mode) || console->f_frame_open) {
+        return false;
+    }
+
+    frame_begin(console, ECDC_FRAME_ID_NOTIFY);
+    return true;
+}
+
+static void
+frame_receive_reset(struct ecdc_console * console)
+{
+    arg_line_clear(console);
+    console->frame_rx_crc = 0;
+    console->frame_rx_len = 0;
+    console->frame_status = ECDC_FRAME_STATUS_OK;
+    console->f_frame_escape = false;
+    console->f_frame_error = false;
+}
+
+// Request bytes after the ID go straight into the argument line, CRC
+// included, so that it is split as it arrives
+static void
+frame_receive(struct ecdc_console * console, char c)
+{
+    console->frame_rx_crc = crc16_update(console->frame_rx_crc, &c, 1);
+
+    if(console->frame_rx_len < FRAME_ID_SIZE) {
+        console->frame_id = (uint16_t)
+            ((console->frame_id << 8) | (unsigned char) c);
+    } else {
+        (void) arg_line_append(console, c);
+    }
+    ++console->frame_rx_len;
+}
+
+// Checks a request once its END arrives, and takes the CRC back off of the
+// argument line. Returns false if it should be dropped
+static bool
+frame_receive_complete(struct ecdc_console * console)
+{
+    if(console->f_frame_error
+        || (console->frame_rx_len < (FRAME_ID_SIZE + FRAME_CRC_SIZE))
+        || (0 != console->frame_rx_crc))
+    {
+        return false;
+    }
+
+    // Once the line is full, the rest of the request was dropped
+    size_t line_length = console->frame_rx_len
+        - FRAME_ID_SIZE - FRAME_CRC_SIZE;
+    if(console->arg_line_write_index < line_length) {
+        console->frame_status = ECDC_FRAME_STATUS_OVERFLOW;
+    } else {
+        while(console->arg_line_write_index > line_length) {
+            (void) arg_line_backspace(console);
+        }
+    }
+
+    return true;
+}
+
+
+// ------------------- Formatted output
+
+// Longest formatted number: a 64 bit value in decimal, or a fixed point
+// value with its integer part, point, and fraction
+#define FORMAT_NUMBER_SIZE              32
+#define FORMAT_MAX_PRECISION            9
+
+static const char FORMAT_SPACES[] = "                ";
+static const char FORMAT_ZEROS[] = "0000000000000000";
+
+struct format_spec {
+    bool                                f_left;
+    bool                                f_zero;
+    bool                                f_alternate;
+    char                                sign;
+    size_t                              width;
+    int                                 precision;
+};
+
+// Writes characters that never need translation
+static void
+format_write(struct ecdc_console * console, const char * s, size_t len)
+{
+    frame_checksum(console, s, len);
+    term_write(console, s, len);
+}
+
+static void
+format_pad(struct ecdc_console * console, const char * fill, size_t count)
+{
+    while(0 < count) {
+        size_t len = sizeof(FORMAT_SPACES) - 1;
+        if(len > count) {
+            len = count;
+        }
+        format_write(console, fill, len);
+        count -= len;
+    }
+}
+
+// Writes digits back to front, ending just before end. Bases 8 and 16 shift,
+// and decimal values that fit in 32 bits use 32 bit division, which is much cheaper on small cores
+static size_t
+format_unsigned(char * end,
+                unsigned long long value,
+                unsigned int base,
+                bool f_upper)
+{
+    const char * digits = f_upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char * p = end;
+
+    if(16 == base) {
+        do {
+            *--p = digits[value & 0xF];
+            value >>= 4;
+        } while(0 != value);
+    } else if(8 == base) {
+        do {
+            *--p = digits[value & 0x7];
+            value >>= 3;
+        } while(0 != value);
+    } else if(value <= 0xFFFFFFFFul) {
+        uint32_t value_32 = (uint32_t) value;
+        do {
+            *--p = (char) ('0' + (value_32 % 10));
+            value_32 /= 10;
+        } while(0 != value_32);
+    } else {
+        do {
+            *--p = (char) ('0' + (value % 10));
+            value /= 10;
+        } while(0 != value);
+    }
+
+    return (size_t) (end - p);
+}
+
+// Writes a formatted field. Returns the number of characters in it
+static size_t
+format_field(struct ecdc_console * console,
+             const struct format_spec * spec,
+             const char * prefix,
+             size_t prefix_len,
+             const char * body,
+             size_t body_len,
+             bool f_translate)
+{
+    // Precision is the minimum number of digits for integers
+    size_t zeros = 0;
+    if((0 <= spec->precision) && (body_len < (size_t) spec->precision)) {
+        zeros = (size_t) spec->precision - body_len;
+    }
+
+    size_t total = prefix_len + zeros + body_len;
+    size_t pad = (spec->width > total) ? (spec->width - total) : 0;
+
+    if(!spec->f_left && !spec->f_zero) {
+        format_pad(console, FORMAT_SPACES, pad);
+    }
+    format_write(console, prefix, prefix_len);
+    if(!spec->f_left && spec->f_zero) {
+        format_pad(console, FORMAT_ZEROS, pad);
+    }
+    format_pad(console, FORMAT_ZEROS, zeros);
+    if(f_translate) {
+        term_write_translated(console, body, body_len);
+    } else {
+        format_write(console, body, body_len);
+    }
+    if(spec->f_left) {
+        format_pad(console, FORMAT_SPACES, pad);
+    }
+
+    return total + pad;
+}
+
+#if ECDC_ENABLE_PRINTF_FLOAT
+// Fixed point, without libm. Values are split into 64 bit integer and
+// fraction parts, so magnitudes from 2^64 up are written as "ovf"
+static size_t
+format_fixed(char * end, double value, int precision)
+{
+    char * p = end;
+
+    if(value != value) {
+        p -= 3;
+        memcpy(p, "nan", 3);
+    } else if(value >= 18446744073709551616.0) {
+        p -= 3;
+        memcpy(p, "ovf", 3);
+    } else {
+        unsigned long long scale = 1;
+        int i;
+        for(i = 0; i < precision; ++i) {
+            scale *= 10;
+        }
+
+        unsigned long long integer = (unsigned long long) value;
+        unsigned long long fraction = (unsigned long long)
+            (((value - (double) integer) * (double) scale) + 0.5);
+        if(fraction >= scale) {
+            ++integer;
+            fraction -= scale;
+        }
+
+        if(0 < precision) {
+            size_t digits = format_unsigned(p, fraction, 10, false);
+            p -= digits;
+            while(digits < (size_t) precision) {
+                *--p = '0';
+                ++digits;
+            }
+            *--p = '.';
+        }
+        p -= format_unsigned(p, integer, 10, false);
+    }
+
+    return (size_t) (end - p);
+}
+#endif /* ECDC_ENABLE_PRINTF_FLOAT */
+
+static int
+format_output(struct ecdc_console * console, const char * format, va_list args)
+{
+    size_t count = 0;
+    char number[FORMAT_NUMBER_SIZE];
+    char * const number_end = &number[FORMAT_NUMBER_SIZE];
+
+    while('\0' != *format) {
+        // Literal text up to the next conversion
+        const char * literal = format;
+        while(('\0' != *format) && ('%' != *format)) {
+            ++format;
+        }
+        if(format != literal) {
+            size_t len = (size_t) (format - literal);
+            term_write_translated(console, literal, len);
+            count += len;
+        }
+        if('\0' == *format) {
+            break;
+        }
+        const char * conversion_start = format;
+        ++format;
+
+        // Flags
+        struct format_spec spec = { false, false, false, '\0', 0, -1 };
+        for(;; ++format) {
+            if('-' == *format) {
+                spec.f_left = true;
+            } else if('0' == *format) {
+                spec.f_zero = true;
+            } else if('#' == *format) {
+                spec.f_alternate = true;
+            } else if('+' == *format) {
+                spec.sign = '+';
+            } else if((' ' == *format) && ('+' != spec.sign)) {
+                spec.sign = ' ';
+            } else {
+                break;
+            }
+        }
+
+        // Width and precision
+        if('*' == *format) {
+            int width = va_arg(args, int);
+            if(width < 0) {
+                spec.f_left = true;
+                width = -width;
+            }
+            spec.width = (size_t) width;
+            ++format;
+        } else {
+            while(('0' <= *format) && ('9' >= *format)) {
+                spec.width = (spec.width * 10) + (size_t) (*format++ - '0');
+            }
+        }
+        if('.' == *format) {
+            ++format;
+            spec.precision = 0;
+            if('*' == *format) {
+                spec.precision = va_arg(args, int);
+                ++format;
+            } else {
+                while(('0' <= *format) && ('9' >= *format)) {
+                    spec.precision = (spec.precision * 10) + (*format++ - '0');
+                }
+            }
+        }
+
+        // Length: 0 int, 1 long, 2 long long, 3 size_t, 4 intmax_t,
+        // 5 ptrdiff_t and 6 long double
+        int length = 0;
+        if('h' == *format) {
+            while('h' == *format) {
+                ++format;
+            }
+        } else if('l' == *format) {
+            length = 1;
+            if('l' == *++format) {
+                length = 2;
+                ++format;
+            }
+        } else if('z' == *format) {
+            length = 3;
+            ++format;
+        } else if('j' == *format) {
+            length = 4;
+            ++format;
+        } else if('t' == *format) {
+            length = 5;
+            ++format;
+        } else if('L' == *format) {
+            length = 6;
+            ++format;
+        }
+
+        char conversion = *format;
+        if('\0' == conversion) {
+            break;
+        }
+        ++format;
+
+        switch(conversion) {
+            case 'd':
+            case 'i': {
+                long long value;
+                if(1 == length) {
+                    value = va_arg(args, long);
+                } else if(2 == length) {
+                    value = va_arg(args, long long);
+                } else if(3 == length) {
+                    value = (long long) va_arg(args, size_t);
+                } else if(4 == length) {
+                    value = (long long) va_arg(args, intmax_t);
+                } else if(5 == length) {
+                    value = (long long) va_arg(args, ptrdiff_t);
+                } else {
+                    value = va_arg(args, int);
+                }
+
+                char sign = spec.sign;
+                unsigned long long magnitude = (unsigned long long) value;
+                if(value < 0) {
+                    sign = '-';
+                    magnitude = 0 - magnitude;
+                }
+
+                size_t len = format_unsigned(number_end, magnitude, 10, false);
+                if(0 <= spec.precision) {
+                    spec.f_zero = false;
+                }
+                count += format_field(console, &spec,
+                                      &sign, ('\0' != sign) ? 1 : 0,
+                                      number_end - len, len, false);
+                break;
+            }
+
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+            case 'p': {
+                unsigned long long value;
+                if('p' == conversion) {
+                    value = (uintptr_t) va_arg(args, void *);
+                    spec.f_alternate = true;
+                } else if(1 == length) {
+                    value = va_arg(args, unsigned long);
+                } else if(2 == length) {
+                    value = va_arg(args, unsigned long long);
+                } else if(3 == length) {
+                    value = va_arg(args, size_t);
+                } else if(4 == length) {
+                    value = va_arg(args, uintmax_t);
+                } else if(5 == length) {
+                    value = (unsigned long long) va_arg(args, ptrdiff_t);
+                } else {
+                    value = va_arg(args, unsigned int);
+                }
+
+                unsigned int base = ('u' == conversion) ? 10
+                                  : ('o' == conversion) ? 8
+                                  : 16;
+                size_t len = format_unsigned(number_end, value, base,
+                                             ('X' == conversion));
+
+                // The alternate form of octal starts with a 0
+                const char * prefix = ('X' == conversion) ? "0X"
+                                    : (8 == base) ? "0"
+                                    : "0x";
+                size_t prefix_len = 0;
+                if(spec.f_alternate && (16 == base)) {
+                    prefix_len = 2;
+                } else if(spec.f_alternate && (8 == base) && (0 != value)) {
+                    prefix_len = 1;
+                }
+                if(0 <= spec.precision) {
+                    spec.f_zero = false;
+                }
+                count += format_field(console, &spec, prefix, prefix_len,
+                                      number_end - len, len, false);
+                break;
+            }
+
+            #if ECDC_ENABLE_PRINTF_FLOAT
+            case 'f':
+            case 'F': {
+                double value = va_arg(args, double);
+                int precision = spec.precision;
+                if(precision < 0) {
+                    precision = 6;
+                } else if(precision > FORMAT_MAX_PRECISION) {
+                    precision = FORMAT_MAX_PRECISION;
+                }
+
+                char sign = spec.sign;
+                if(value < 0) {
+                    sign = '-';
+                    value = -value;
+                }
+
+                size_t len = format_fixed(number_end, value, precision);
+                spec.precision = -1;
+                count += format_field(console, &spec,
+                                      &sign, ('\0' != sign) ? 1 : 0,
+                                      number_end - len, len, false);
+                break;
+            }
+            #endif /* ECDC_ENABLE_PRINTF_FLOAT */
+
+            case 'c': {
+                char c = (char) va_arg(args, int);
+                spec.f_zero = false;
+                spec.precision = -1;
+                count += format_field(console, &spec, NULL, 0, &c, 1, true);
+                break;
+            }
+
+            case 's': {
+                const char * str = va_arg(args, const char *);
+                if(NULL == str) {
+                    str = "(null)";
+                }
+
+                size_t len = 0;
+                while(('\0' != str[len])
+                    && ((spec.precision < 0) || (len < (size_t) spec.precision))) {
+                    ++len;
+                }
+
+                spec.f_zero = false;
+                spec.precision = -1;
+                count += format_field(console, &spec, NULL, 0, str, len, true);
+                break;
+            }
+
+            case '%':
+                format_write(console, "%", 1);
+                ++count;
+                break;
+
+            default: {
+                // Unsupported. Standard conversions still take their argument,
+                // so that the ones after it stay in step. The conversion is
+                // written out as is so it shows up
+                if(NULL != strchr("aAeEfFgG", conversion)) {
+                    if(6 == length) {
+                        (void) va_arg(args, long double);
+                    } else {
+                        (void) va_arg(args, double);
+                    }
+                } else if('n' == conversion) {
+                    (void) va_arg(args, void *);
+                }
+
+                size_t len = (size_t) (format - conversion_start);
+                format_write(console, conversion_start, len);
+                count += len;
+                break;
+            }
+        }
+    }
+
+    return (int) count;
+}
+
+static int
+term_printf(struct ecdc_console * console, const char * format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int count = format_output(console, format, args);
+    va_end(args);
+
+    return count;
+}
+
+
+// ------------------ Character reading
+
+static void
+term_release_ring_window(struct ecdc_console * console)
+{
+    // Only a window in the ring has a span. Fed input is the caller's
+    if(0 == console->rx_ring_span) {
+        return;
+    }
+
+    // Hand back the part of the ring window that has been consumed
+    size_t consumed = console->rx_ring_span - console->rx_len;
+    if(0 < consumed) {
+        struct rx_ring * ring = console->rx_ring;
+        size_t tail = RING_LOAD_RELAXED(&ring->consumer.c.tail);
+        RING_STORE_RELEASE(&ring->consumer.c.tail, tail + consumed);
+        console->rx_ring_span = console->rx_len;
+    }
+}
+
+static bool
+term_read_ring(struct ecdc_console * console)
+{
+    struct rx_ring * ring = console->rx_ring;
+    if(NULL == ring) {
+        return false;
+    }
+
+    term_release_ring_window(console);
+
+    // Use the contiguous part of the ring as the read window, the rest is
+    // picked up once this has been consumed
+    size_t tail = RING_LOAD_RELAXED(&ring->consumer.c.tail);
+    size_t head = RING_LOAD_ACQUIRE(&ring->producer.p.head);
+    size_t offset = tail & ring->mask;
+    size_t available = head - tail;
+    size_t contiguous = ring->mask + 1 - offset;
+
+    console->rx_ptr = &ring->data[offset];
+    console->rx_len = (available < contiguous) ? available : contiguous;
+    console->rx_ring_span = console->rx_len;
+
+    return (0 < console->rx_len);
+}
+
+static bool
+term_read_block(struct ecdc_console * console)
+{
+    if(console->f_feeding) {
+        return false;
+    }
+
+    if(term_read_ring(console)) {
+        STATS_ADD(console, bytes_received, console->rx_len);
+        return true;
+    }
+
+    if(NULL == console->read) {
+        return false;
+    }
+
+    console->rx_ptr = console->read_buffer;
+    console->rx_len = console->read(console->hint,
+                                    console->read_buffer,
+                                    console->read_buffer_size);
+    if(console->rx_len > console->read_buffer_size) {
+        // Misbehaving transport, don't read past the end of the buffer
+        console->rx_len = console->read_buffer_size;
+    }
+    STATS_ADD(console, bytes_received, console->rx_len);
+
+    return (0 < console->rx_len);
+}
+
+static inline int
+term_getc_raw(struct ecdc_console * console)
+{
+    int ret = console->snoop_char;
+    console->snoop_char = ECDC_GETC_EOF;
+
+    // A snooped character was already paid for when it was first read
+    if((ECDC_GETC_EOF == ret)
+        && (0 < console->budget)
+        && !console->f_input_eof) {
+
+        if((0 < console->rx_len) || term_read_block(console)) {
+            ret = (unsigned char) *console->rx_ptr;
+            ++console->rx_ptr;
+            --console->rx_len;
+        } else if((NULL != console->getc) && !console->f_feeding) {
+            ret = console->getc(console->hint);
+            if(ECDC_GETC_EOF != ret) {
+                STATS_INC(console, bytes_received);
+            }
+        }
+
+        if(ECDC_GETC_EOF == ret) {
+            // Don't poll the transport again for the rest of the pump
+            console->f_input_eof = true;
+        } else {
+            --console->budget;
+            TRACE(console, ECDC_TRACE_INPUT, ret);
+        }
+    }
+
+    return ret;
+}
+
+// Takes a run of printable characters (see printable_run_length) of up to
+// limit characters straight out of the read window. Returns NULL if there is
+// none
+static inline const char *
+term_read_run(struct ecdc_console * console, size_t limit, size_t * len)
+{
+    #if ECDC_ENABLE_TRACE
+    // A trace records input one character at a time
+    if(NULL != console->trace) {
+        return NULL;
+    }
+    #endif /* ECDC_ENABLE_TRACE */
+
+    if((ECDC_GETC_EOF != console->snoop_char) || (0 == console->rx_len)) {
+        return NULL;
+    }
+
+    if(limit > console->rx_len) {
+        limit = console->rx_len;
+    }
+    if(limit > console->budget) {
+        limit = console->budget;
+    }
+
+    size_t run_len = printable_run_length(console->rx_ptr, limit);
+    if(0 == run_len) {
+        return NULL;
+    }
+
+    const char * run = console->rx_ptr;
+    console->rx_ptr += run_len;
+    console->rx_len -= run_len;
+    console->budget -= run_len;
+
+    *len = run_len;
+    return run;
+}
+
+static inline void
+term_set_snoop_char(struct ecdc_console * console, char c)
+{
+    console->snoop_char = (unsigned char) c;
+}
+
+static inline size_t
+term_buffered_input(struct ecdc_console * console)
+{
+    return console->rx_len + ((ECDC_GETC_EOF != console->snoop_char) ? 1 : 0);
+}
+
+
+// ---------------------------------------------------- State machine functions
+
+static void
+state_start_new_command(struct ecdc_console * console);
+
+static void
+state_read_input(struct ecdc_console * console);
+
+static void
+state_run_command(struct ecdc_console * console);
+
+
+// Replaces the line with the history entry under the cursor, or with an
+// empty line when not browsing. The line is redrawn with one carriage return
+// and erase, rather than a backspace per character
+static void
+history_recall(struct ecdc_console * console)
+{
+    struct history * history = console->history;
+
+    arg_line_clear(console);
+    term_puts_raw(console, "\r\x1B[K", 4);
+    term_put_prompt(console);
+
+    if(history->f_browsing) {
+        size_t length = history_get_length(history, history->cursor);
+        size_t start = history_wrap(history,
+            history->cursor + HISTORY_LENGTH_SIZE);
+
+        // The entry may wrap around the end of the ring
+        size_t first = history->size - start;
+        if(first > length) {
+            first = length;
+        }
+
+        term_puts_raw(console, &history->data[start], first);
+        term_puts_raw(console, history->data, length - first);
+
+        size_t i;
+        for(i = 0; i < first; ++i) {
+            (void) arg_line_append(console, history->data[start + i]);
+        }
+        for(i = 0; i < (length - first); ++i) {
+            (void) arg_line_append(console, history->data[i]);
+        }
+    }
+}
+
+static void
+state_parse_escape_sequence_ansi(struct ecdc_console * console)
+{
+    // Cursor up and down recall history
+    if((NULL != console->history)
+        && (3 == console->cs_write_index)
+        && ('[' == console->cs_buffer[1]))
+    {
+        bool moved = false;
+        switch(console->cs_buffer[2]) {
+            case 'A':
+                moved = history_older(console->history);
+                break;
+            case 'B':
+                moved = history_newer(console->history);
+                break;
+            default:
+                break;
+        }
+
+        if(moved) {
+            history_recall(console);
+        }
+    }
+
+    console->state = state_read_input;
+}
+
+static void
+state_read_escape_sequence(struct ecdc_console * console)
+{
+    bool abort_sequence = false;
+    bool parse_sequence = false;
+
+    for(;;)
+    {
+        int new_char = term_getc_raw(console);
+        if(ECDC_GETC_EOF == new_char) {
+            break;
+        }
+
+        char in = new_char;
+
+        if(('\x18' == in) || ('\x1A' == in)) {
+            // CAN or SUB
+            abort_sequence = true;
+            break;
+        } else if(console->cs_write_index < CS_BUFFER_SIZE) {
+            console->cs_buffer[console->cs_write_index] = in;
+            size_t index = console->cs_write_index;
+            ++console->cs_write_index;
+
+            if(1 == index) {
+                if('[' == in) {
+                    // Control sequence introducer, this will be a 3 or more
+                    // character sequence
+                } else if(('\x40' <= in) && ('\x5F' >= in)) {
+                    // End of a two character escape sequence
+                    parse_sequence = true;
+                    break;
+                }
+            } else if(1 < index) {
+                if(('\x40' <= in) && ('\x7E' >= in)) {
+                    // End of a multi character sequence
+                    parse_sequence = true;
+                    break;
+                }
+            }
+        } else {
+            // Dump the sequence, parsing it would be meaningless
+            term_set_snoop_char(console, in);
+            abort_sequence = true;
+            break;
+        }
+    }
+
+    if(abort_sequence) {
+        STATS_INC(console, escape_aborts);
+        TRACE(console, ECDC_TRACE_ESCAPE_ABORT, console->cs_write_index);
+        term_puts_raw(console, console->cs_buffer, console->cs_write_index);
+        console->cs_write_index = 0;
+        console->state = state_read_input;
+    } else if(parse_sequence) {
+        switch(console->mode) {
+            case ECDC_MODE_ANSI:
+            default:
+                console->state = state_parse_escape_sequence_ansi;
+                break;
+        }
+    }
+}
+
+static void
+completion_list(struct ecdc_console * console,
+                const struct candidate * candidate,
+                void * context)
+{
+    (void) context;
+
+    term_puts(console, candidate->name);
+    term_put_newline(console);
+}
+
+static void
+complete_append(struct ecdc_console * console, const char * s, size_t len)
+{
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        if(!arg_line_append(console, s[i])) {
+            break;
+        }
+        term_putc_raw(console, s[i]);
+    }
+}
+
+static void
+complete_command(struct ecdc_console * console)
+{
+    // Only the command name is completed, and only at its end
+    const char * prefix = console->argv[0];
+    if((1 != console->argc)
+        || ((prefix + strlen(prefix))
+            != &console->arg_line[console->arg_line_write_index]))
+    {
+        return;
+    }
+
+    size_t prefix_length = strlen(prefix);
+    const struct registry_snapshot * snapshot = candidates_lock(console);
+
+    struct completion completion = { { NULL, NULL, NULL, NULL }, 0, 0 };
+    for_each_candidate(console, snapshot, prefix, completion_add, &completion);
+
+    if(1 == completion.count) {
+        // Unique, complete the name and start the next argument
+        complete_append(console,
+                        &completion.first.name[prefix_length],
+                        completion.common_length - prefix_length);
+        complete_append(console, " ", 1);
+    } else if(completion.common_length > prefix_length) {
+        // Complete as far as the candidates agree
+        complete_append(console,
+                        &completion.first.name[prefix_length],
+                        completion.common_length - prefix_length);
+    } else if(completion.count > 1) {
+        // List the candidates, then restore the line
+        term_put_newline(console);
+        for_each_candidate(console, snapshot, prefix, completion_list, NULL);
+        term_put_prompt(console);
+        term_put_arg_line(console);
+    }
+
+    candidates_unlock(console);
+}
+
+static void
+run_console_command(struct ecdc_console * console,
+                    struct ecdc_command * command,
+                    size_t argc)
+{
+    if(NULL != command->resumable) {
+        // Runs from its own state, starting in this pump
+        console->running = command;
+        console->running_state = NULL;
+        console->running_argc = argc;
+        console->state = state_run_command;
+    } else {
+        command_call(console, command, argc);
+    }
+}
+
+static bool
+dispatch_command(struct ecdc_console * console, size_t argc)
+{
+    const char * name = console->argv[0];
+    STATS_INC(console, lines_dispatched);
+    TRACE(console, ECDC_TRACE_DISPATCH, argc);
+
+    // Console commands first
+    struct ecdc_command * command = locate_command(console, name);
+    if(NULL != command) {
+        run_console_command(console, command, argc);
+        return true;
+    }
+
+    // Then the shared registry
+    #if ECDC_ENABLE_REGISTRY
+    if(NULL != console->registry) {
+        const struct registry_snapshot * snapshot = registry_read_lock(console);
+
+        size_t position;
+        const struct registry_entry * entry =
+            snapshot_search(snapshot, name, &position);
+        if(NULL != entry) {
+            entry->callback(entry->hint, argc, console->argv);
+        }
+
+        registry_read_unlock(console);
+        if(NULL != entry) {
+            return true;
+        }
+    }
+    #endif /* ECDC_ENABLE_REGISTRY */
+
+    // Then the static command table
+    const struct ecdc_static_command * static_command =
+        locate_static_command(name);
+    if(NULL != static_command) {
+        static_command->callback(static_command->hint, argc, console->argv);
+        return true;
+    }
+
+    // And finally a unique prefix of any command name
+    bool found = false;
+    if(console->f_prefix_match) {
+        const struct registry_snapshot * snapshot = candidates_lock(console);
+
+        struct completion completion = { { NULL, NULL, NULL, NULL }, 0, 0 };
+        for_each_candidate(console, snapshot, name, completion_add, &completion);
+
+        if(1 == completion.count) {
+            // Commands see their full name
+            console->argv[0] = completion.first.name;
+            if(NULL != completion.first.command) {
+                run_console_command(console, completion.first.command, argc);
+            } else {
+                completion.first.callback(completion.first.hint,
+                                          argc,
+                                          console->argv);
+            }
+            found = true;
+        }
+
+        candidates_unlock(console);
+    }
+
+    if(!found) {
+        STATS_INC(console, unknown_commands);
+        TRACE(console, ECDC_TRACE_UNKNOWN_COMMAND, argc);
+    }
+    return found;
+}
+
+static void
+state_parse_input(struct ecdc_console * console)
+{
+    // Arguments were split as the line was read
+    size_t argc = console->argc;
+    bool f_framed = (ECDC_MODE_FRAMED == console->mode);
+
+    if((NULL != console->history) && (argc > 0) && !f_framed) {
+        history_add(console->history,
+                    console->arg_line,
+                    console->arg_line_write_index);
+    }
+
+    // Search for handler. A resumable command changes the state
+    console->state = state_start_new_command;
+    if(f_framed) {
+        // The response is finished when the next command starts
+        frame_begin(console, console->frame_id);
+        if((ECDC_FRAME_STATUS_OK == console->frame_status)
+            && (argc > 0)
+            && !dispatch_command(console, argc))
+        {
+            console->frame_status = ECDC_FRAME_STATUS_NOT_FOUND;
+        }
+    } else if((argc > 0) && !dispatch_command(console, argc)) {
+        term_puts(console, "'");
+        term_puts(console, console->argv[0]);
+        term_puts(console, "' not found\n");
+    }
+}
+
+// Runs a line in batch mode, and notes it if it fails. Lines that overflowed
+// are not run
+static void
+batch_run_line(struct ecdc_console * console)
+{
+    ++console->batch_lines;
+
+    bool f_failed = console->f_line_overflow;
+    if(!f_failed && (0 < console->argc)) {
+        f_failed = !dispatch_command(console, console->argc);
+    }
+
+    if(f_failed) {
+        if(console->batch_failed < BATCH_MAX_FAILED_LINES) {
+            console->batch_failed_lines[console->batch_failed] =
+                console->batch_lines;
+        }
+        ++console->batch_failed;
+    }
+
+    // A resumable command needs its arguments until it is done
+    if(state_read_input == console->state) {
+        arg_line_clear(console);
+    }
+}
+
+static void
+batch_begin(struct ecdc_console * console)
+{
+    arg_line_clear(console);
+
+    console->f_batch = true;
+    console->f_batch_cr = false;
+    console->batch_lines = 0;
+    console->batch_failed = 0;
+}
+
+// Runs what is left of the last line, and writes the summary
+static void
+batch_end(struct ecdc_console * console)
+{
+    if(!console->f_batch) {
+        return;
+    }
+
+    bool f_reading = (state_read_input == console->state);
+    if(f_reading && (0 < console->arg_line_write_index)) {
+        batch_run_line(console);
+        f_reading = (state_read_input == console->state);
+    }
+    console->f_batch = false;
+
+    term_printf(console, "batch: %lu lines, %lu failed",
+                (unsigned long) console->batch_lines,
+                (unsigned long) console->batch_failed);
+
+    uint32_t i;
+    for(i = 0; (i < console->batch_failed) && (i < BATCH_MAX_FAILED_LINES); ++i) {
+        term_printf(console, (0 == i) ? ": %lu" : " %lu",
+                    (unsigned long) console->batch_failed_lines[i]);
+    }
+    if(console->batch_failed > BATCH_MAX_FAILED_LINES) {
+        term_puts(console, " ...");
+    }
+    term_put_newline(console);
+
+    // Otherwise the prompt comes when the running command is done
+    if(f_reading) {
+        term_put_prompt(console);
+    }
+}
+
+static void
+state_run_command(struct ecdc_console * console)
+{
+    struct ecdc_command * command = console->running;
+
+    if((NULL != command) && (ECDC_CONTINUE == command_step(console, command)))
+    {
+        // Give the rest of the pump back to the application
+        console->f_yield = true;
+    } else {
+        console->running = NULL;
+        console->state = state_start_new_command;
+    }
+}
+
+static void
+state_read_input(struct ecdc_console * console)
+{
+    for(;;)
+    {
+        // Runs of printable characters in a block of input are stored and
+        // echoed at once
+        size_t run_len;
+        const char * run = term_read_run(
+            console,
+            console->arg_line_size - console->arg_line_write_index,
+            &run_len);
+        if(NULL != run) {
+            arg_line_append_run(console, run, run_len);
+            if(console->f_local_echo && !console->f_batch) {
+                term_puts_raw(console, run, run_len);
+            }
+            continue;
+        }
+
+        int new_char = term_getc_raw(console);
+        if(ECDC_GETC_EOF == new_char) {
+            break;
+        }
+
+        bool local_echo = false;
+
+        char in = new_char;
+        if(console->f_batch && (('\r' == in) || ('\n' == in))) {
+            // Lines are run as soon as they end, without leaving this state.
+            // \r\n is a single line ending
+            bool f_crlf = ('\n' == in)
+                && console->f_batch_cr
+                && (0 == console->arg_line_write_index);
+            console->f_batch_cr = ('\r' == in);
+
+            // Each line goes back to the pump, so a long script still
+            // checks the deadline between lines
+            if(!f_crlf) {
+                batch_run_line(console);
+                break;
+            }
+        } else if('\r' == in) {
+            term_put_newline(console);
+            console->state = state_parse_input;
+            break;
+        } else if((ECDC_BATCH_BEGIN == in) && console->f_batch_control) {
+            batch_begin(console);
+        } else if((ECDC_BATCH_END == in) && console->f_batch_control) {
+            batch_end(console);
         } else if('\x00' == in) {
             // Nothing to do here
         } else if(('\x08' == in) || ('\x7F' == in)) {
@@ -589,285 +3164,1803 @@ state_read_input(struct ecdc_console * console)
             // This stuff gets super weird, apparently everyone on the planet
             // screwed up how backspace and delete work. See
             // http://www.ibb.net/~anne/keyboard.html for the full train wreck
-            if(console->arg_line_write_index > 0) {
+            if(arg_line_backspace(console) && !console->f_batch) {
                 term_backspace(console);
-                --console->arg_line_write_index;
             }
-        } else if('\x1B' == in) {
-            // Start of a control sequence
-            term_set_snoop_char(console, in);
-            console->cs_write_index = 0;
-            console->state = state_read_escape_sequence;
-        } else if('\x1F' < in) {
-            // Non-control sequence characters
-            if(console->arg_line_write_index < console->arg_line_size) {
-                console->arg_line[console->arg_line_write_index] = in;
-                ++console->arg_line_write_index;
-                local_echo = console->f_local_echo;
+        } else if(('\x09' == in) && console->f_batch) {
+            // Whitespace in a script
+            (void) arg_line_append(console, in);
+        } else if('\x09' == in) {
+            // Tab
+            complete_command(console);
+        } else if('\x1B' == in) {
+            // Start of a control sequence
+            term_set_snoop_char(console, in);
+            console->cs_write_index = 0;
+            console->state = state_read_escape_sequence;
+            break;
+        } else if('\x1F' < in) {
+            // Non-control sequence characters
+            if(arg_line_append(console, in)) {
+                local_echo = console->f_local_echo && !console->f_batch;
+            }
+        }
+
+        if(local_echo) {
+            term_putc_raw(console, in);
+        }
+    }
+}
+
+static void
+state_read_frame(struct ecdc_console * console)
+{
+    for(;;)
+    {
+        int new_char = term_getc_raw(console);
+        if(ECDC_GETC_EOF == new_char) {
+            break;
+        }
+
+        char in = new_char;
+        if(FRAME_END == in) {
+            if(frame_receive_complete(console)) {
+                console->state = state_parse_input;
+                break;
+            }
+
+            // Bad or empty frame, line noise ends up here
+            frame_receive_reset(console);
+        } else if(console->f_frame_escape) {
+            console->f_frame_escape = false;
+            if(FRAME_ESC_END == in) {
+                frame_receive(console, FRAME_END);
+            } else if(FRAME_ESC_ESC == in) {
+                frame_receive(console, FRAME_ESC);
+            } else {
+                console->f_frame_error = true;
+            }
+        } else if(FRAME_ESC == in) {
+            console->f_frame_escape = true;
+        } else {
+            frame_receive(console, in);
+        }
+    }
+}
+
+static void
+state_start_new_command(struct ecdc_console * console)
+{
+    // Clear input string and argv
+    arg_line_clear(console);
+
+    if(NULL != console->history) {
+        console->history->f_browsing = false;
+    }
+
+    if(ECDC_MODE_FRAMED == console->mode) {
+        // Finish the last response, there is no prompt
+        frame_end(console, console->frame_status);
+        frame_receive_reset(console);
+        console->state = state_read_frame;
+        return;
+    }
+
+    // Set new state to read user input
+    if(!console->f_batch) {
+        term_put_prompt(console);
+    }
+    console->state = state_read_input;
+}
+
+static void
+state_wait_for_client(struct ecdc_console * console)
+{
+    int in = term_getc_raw(console);
+    if(ECDC_GETC_EOF != in) {
+        term_set_snoop_char(console, in);
+        console->state = state_start_new_command;
+    }
+}
+
+
+static inline bool
+state_is_reading(console_state_fn state)
+{
+    return (state_read_input == state)
+        || (state_read_frame == state)
+        || (state_read_escape_sequence == state)
+        || (state_wait_for_client == state);
+}
+
+
+// ---------------------------------------------------------- Build in commands
+
+static void
+built_in_list_command(void * hint, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    struct ecdc_console * console = (struct ecdc_console *) hint;
+
+    struct ecdc_command * command;
+    for(command = console->root; NULL != command; command = command->next) {
+        term_puts(console, command->name);
+        term_put_newline(console);
+    }
+
+    #if ECDC_ENABLE_REGISTRY
+    if(NULL != console->registry) {
+        const struct registry_snapshot * snapshot = registry_read_lock(console);
+        size_t i;
+        for(i = 0; (NULL != snapshot) && (i < snapshot->count); ++i) {
+            term_puts(console, snapshot->entries[i].name);
+            term_put_newline(console);
+        }
+        registry_read_unlock(console);
+    }
+    #endif /* ECDC_ENABLE_REGISTRY */
+
+    const struct ecdc_static_command * static_command;
+    for(static_command = STATIC_COMMANDS_BEGIN;
+        static_command < STATIC_COMMANDS_END;
+        ++static_command) {
+
+        term_puts(console, static_command->name);
+        term_put_newline(console);
+    }
+}
+
+#if ECDC_ENABLE_STATS
+static void
+built_in_stats_command(void * hint, int argc, char const * argv[])
+{
+    struct ecdc_console * console = (struct ecdc_console *) hint;
+
+    if((argc > 1) && (0 == strcmp(argv[1], "reset"))) {
+        memset(&console->stats, 0, sizeof(console->stats));
+        return;
+    }
+
+    const struct ecdc_stats * stats = &console->stats;
+    term_printf(console, "bytes_received   %lu\n", stats->bytes_received);
+    term_printf(console, "bytes_sent       %lu\n", stats->bytes_sent);
+    term_printf(console, "send_calls       %lu\n", stats->send_calls);
+    term_printf(console, "lines_dispatched %lu\n", stats->lines_dispatched);
+    term_printf(console, "unknown_commands %lu\n", stats->unknown_commands);
+    term_printf(console, "overflow_drops   %lu\n", stats->overflow_drops);
+    term_printf(console, "escape_aborts    %lu\n", stats->escape_aborts);
+    term_printf(console, "max_pump_ticks   %lu\n", stats->max_pump_ticks);
+}
+#endif /* ECDC_ENABLE_STATS */
+
+#if ECDC_ENABLE_PROFILER
+static void
+built_in_profile_command(void * hint, int argc, char const * argv[])
+{
+    struct ecdc_console * console = (struct ecdc_console *) hint;
+
+    if((argc > 1) && (0 == strcmp(argv[1], "reset"))) {
+        ecdc_reset_profiles(console);
+        return;
+    }
+
+    term_puts(console, "name             calls     total_cycles   max_cycles"
+                       "  log2:count\n");
+
+    struct ecdc_command * command;
+    for(command = console->root; NULL != command; command = command->next) {
+        const struct ecdc_profile * profile = &command->profile;
+        if(0 == profile->calls) {
+            continue;
+        }
+
+        term_printf(console, "%-16s %6lu %16llu %12lu ",
+                    command->name,
+                    profile->calls,
+                    profile->total_cycles,
+                    profile->max_cycles);
+
+        size_t i;
+        for(i = 0; i < ECDC_PROFILE_BUCKETS; ++i) {
+            if(0 < profile->histogram[i]) {
+                term_printf(console, " %u:%lu",
+                            (unsigned int) (ECDC_PROFILE_MIN_LOG2 + i + 1),
+                            profile->histogram[i]);
+            }
+        }
+        term_put_newline(console);
+    }
+}
+#endif /* ECDC_ENABLE_PROFILER */
+
+#if ECDC_ENABLE_TRACE
+static const char * const TRACE_EVENT_NAMES[] = {
+    "input",
+    "escape_abort",
+    "dispatch",
+    "unknown_command",
+    "overflow"
+};
+
+static void
+built_in_trace_command(void * hint, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    struct ecdc_console * console = (struct ecdc_console *) hint;
+    struct trace_ring * ring = console->trace;
+    if(NULL == ring) {
+        term_puts(console, "No trace\n");
+        return;
+    }
+
+    // Printing doesn't record anything, so the ring holds still
+    size_t head = RING_LOAD_RELAXED(&ring->head);
+    size_t count = (head < ring->mask) ? head : ring->mask;
+
+    term_puts(console, " timestamp  state               event            "
+                       "payload\n");
+
+    size_t i;
+    for(i = head - count; i != head; ++i) {
+        const struct ecdc_trace_entry * entry = &ring->entries[i & ring->mask];
+        const char * name =
+            (entry->event < (sizeof(TRACE_EVENT_NAMES) / sizeof(char *)))
+                ? TRACE_EVENT_NAMES[entry->event]
+                : "?";
+
+        term_printf(console, "%10lu  %-18p  %-15s  %u\n",
+                    entry->timestamp,
+                    (void *) (uintptr_t) entry->state,
+                    name,
+                    (unsigned int) entry->payload);
+    }
+}
+#endif /* ECDC_ENABLE_TRACE */
+
+
+// ----------------------------------------------------------- Public functions
+
+static struct ecdc_console *
+create_console(struct storage_arena * arena,
+               void * console_hint,
+               ecdc_getc_fn getc_fn,
+               ecdc_read_fn read_fn,
+               ecdc_puts_fn puts_fn,
+               size_t max_arg_line_length,
+               size_t max_arg_count,
+               size_t max_command_count,
+               size_t read_buffer_size)
+{
+    struct ecdc_console * console = NULL;
+    if(NULL == arena) {
+        console = (struct ecdc_console *) malloc(sizeof(struct ecdc_console));
+    } else {
+        console = (struct ecdc_console *)
+            arena_alloc(arena, sizeof(struct ecdc_console));
+    }
+    if(NULL == console) {
+        goto out;
+    }
+
+    if(NULL == arena) {
+        console->arena.base = NULL;
+        console->arena.size = 0;
+        console->arena.used = 0;
+    } else {
+        console->arena = *arena;
+    }
+
+    console->root = NULL;
+    console->tail = NULL;
+    console->index = NULL;
+    console->index_count = 0;
+    console->index_size = 0;
+    console->f_index_valid = true;
+    console->getc = getc_fn;
+    console->read = read_fn;
+    console->puts = puts_fn;
+    console->write = NULL;
+    console->hint = console_hint;
+    console->snoop_char = ECDC_GETC_EOF;
+    console->rx_ptr = NULL;
+    console->rx_len = 0;
+    console->rx_ring = NULL;
+    console->rx_ring_span = 0;
+    console->history = NULL;
+    console->tx_queue = NULL;
+    console->running = NULL;
+    console->running_state = NULL;
+    console->running_argc = 0;
+    console->f_yield = false;
+    console->registry = NULL;
+    console->registry_slot = 0;
+    console->tx_buffer = NULL;
+    console->tx_buffer_size = 0;
+    console->tx_len = 0;
+    console->tx_reserved = 0;
+    console->f_in_pump = false;
+    console->budget = 0;
+    console->f_input_eof = false;
+    console->f_feeding = false;
+    console->frame_id = 0;
+    console->frame_rx_crc = 0;
+    console->frame_tx_crc = 0;
+    console->frame_rx_len = 0;
+    console->frame_status = ECDC_FRAME_STATUS_OK;
+    console->f_frame_escape = false;
+    console->f_frame_error = false;
+    console->f_frame_open = false;
+    console->f_frame_notify = false;
+    console->f_batch = false;
+    console->f_batch_cr = false;
+    console->batch_lines = 0;
+    console->batch_failed = 0;
+    #if ECDC_ENABLE_STATS
+    memset(&console->stats, 0, sizeof(console->stats));
+    console->stats_clock = NULL;
+    #endif /* ECDC_ENABLE_STATS */
+    #if ECDC_ENABLE_PROFILER
+    console->profile_clock = NULL;
+    #endif /* ECDC_ENABLE_PROFILER */
+    #if ECDC_ENABLE_TRACE
+    console->trace = NULL;
+    console->trace_clock = NULL;
+    #endif /* ECDC_ENABLE_TRACE */
+    console->state = state_wait_for_client;
+    console->prompt = NULL;
+    console->pool = NULL;
+
+    if(max_arg_line_length < 16) {
+        max_arg_line_length = 16;
+    }
+    console->arg_line_size = max_arg_line_length;
+    console->arg_line_write_index = 0;
+    console->f_line_overflow = false;
+
+    size_t alloc_size = (max_arg_line_length + 1) * sizeof(char);
+    console->arg_line = (char *) console_alloc(console, alloc_size);
+    if(NULL == console->arg_line) {
+        goto out_arg_line_fail;
+    }
+
+
+    if(max_arg_count < 1) {
+        max_arg_count = 1;
+    }
+    console->max_argc = max_arg_count;
+    console->argc = 0;
+
+    console->argv = (const char **)
+        console_alloc(console, sizeof(char *) * max_arg_count);
+    if(NULL == console->argv) {
+        goto out_argv_fail;
+    }
+
+    size_t i;
+    for(i = 0; i < max_arg_count; ++i) {
+        console->argv[i] = NULL;
+    }
+
+
+    // Fixed size command index, only used with caller provided storage. Heap
+    // consoles grow their index as commands are registered
+    if(0 < max_command_count) {
+        console->index = (struct ecdc_command **)
+            console_alloc(console, sizeof(struct ecdc_command *) * max_command_count);
+        if(NULL == console->index) {
+            goto out_index_fail;
+        }
+        console->index_size = max_command_count;
+    }
+
+
+    // Bulk read buffer, only needed if there is a bulk read function
+    console->read_buffer = NULL;
+    console->read_buffer_size = 0;
+    if(NULL != read_fn) {
+        if(read_buffer_size < 1) {
+            read_buffer_size = 1;
+        }
+        console->read_buffer_size = read_buffer_size;
+
+        console->read_buffer = (char *) console_alloc(console, read_buffer_size);
+        if(NULL == console->read_buffer) {
+            goto out_read_buffer_fail;
+        }
+    }
+
+
+    // Initialize control sequence
+    console->cs_write_index = 0;
+    for(i = 0; i < CS_BUFFER_SIZE; ++i) {
+        console->cs_buffer[i] = '\x00';
+    }
+
+
+    // Set default settings. ecdc_configure_console compares against the
+    // current mode, so the fields are set directly here
+    console->mode = ECDC_MODE_ANSI;
+    console->f_local_echo = true;
+    console->f_prefix_match = false;
+    console->f_batch_control = false;
+
+
+    // Success
+    goto out;
+
+    out_read_buffer_fail:
+        console_free(console, console->index);
+
+    out_index_fail:
+        console_free(console, console->argv);
+
+    out_argv_fail:
+        console_free(console, console->arg_line);
+
+    out_arg_line_fail:
+        console_free(console, console);
+        console = NULL;
+
+    out:
+        return console;
+}
+
+struct ecdc_console *
+ecdc_alloc_console(void * console_hint,
+                   ecdc_getc_fn getc_fn,
+                   ecdc_puts_fn puts_fn,
+                   size_t max_arg_line_length,
+                   size_t max_arg_count)
+{
+    return create_console(NULL,
+                          console_hint,
+                          getc_fn,
+                          NULL,
+                          puts_fn,
+                          max_arg_line_length,
+                          max_arg_count,
+                          0,
+                          0);
+}
+
+struct ecdc_console *
+ecdc_alloc_console_bulk(void * console_hint,
+                        ecdc_read_fn read_fn,
+                        ecdc_puts_fn puts_fn,
+                        size_t max_arg_line_length,
+                        size_t max_arg_count,
+                        size_t read_buffer_size)
+{
+    struct ecdc_console * console = NULL;
+    if(NULL != read_fn) {
+        console = create_console(NULL,
+                                 console_hint,
+                                 NULL,
+                                 read_fn,
+                                 puts_fn,
+                                 max_arg_line_length,
+                                 max_arg_count,
+                                 0,
+                                 read_buffer_size);
+    }
+    return console;
+}
+
+struct ecdc_console *
+ecdc_init_console(void * storage,
+                  size_t storage_size,
+                  void * console_hint,
+                  ecdc_getc_fn getc_fn,
+                  ecdc_puts_fn puts_fn,
+                  size_t max_arg_line_length,
+                  size_t max_arg_count,
+                  size_t max_command_count)
+{
+    struct ecdc_console * console = NULL;
+    if(NULL != storage) {
+        struct storage_arena arena = { (char *) storage, storage_size, 0 };
+        console = create_console(&arena,
+                                 console_hint,
+                                 getc_fn,
+                                 NULL,
+                                 puts_fn,
+                                 max_arg_line_length,
+                                 max_arg_count,
+                                 max_command_count,
+                                 0);
+    }
+    return console;
+}
+
+struct ecdc_console *
+ecdc_init_console_bulk(void * storage,
+                       size_t storage_size,
+                       void * console_hint,
+                       ecdc_read_fn read_fn,
+                       ecdc_puts_fn puts_fn,
+                       size_t max_arg_line_length,
+                       size_t max_arg_count,
+                       size_t max_command_count,
+                       size_t read_buffer_size)
+{
+    struct ecdc_console * console = NULL;
+    if((NULL != storage) && (NULL != read_fn)) {
+        struct storage_arena arena = { (char *) storage, storage_size, 0 };
+        console = create_console(&arena,
+                                 console_hint,
+                                 NULL,
+                                 read_fn,
+                                 puts_fn,
+                                 max_arg_line_length,
+                                 max_arg_count,
+                                 max_command_count,
+                                 read_buffer_size);
+    }
+    return console;
+}
+
+void
+ecdc_free_console(struct ecdc_console * console)
+{
+    if(console != NULL) {
+        // Everything is about to be unregistered, don't bother keeping the
+        // index sorted along the way
+        index_invalidate(console);
+
+        while(NULL != console->root) {
+            list_unlink(console, console->root);
+        }
+
+        #if ECDC_ENABLE_REGISTRY
+        ecdc_detach_registry(console);
+        #endif /* ECDC_ENABLE_REGISTRY */
+
+        term_flush(console);
+
+        console_free(console, console->index);
+        console_free(console, console->tx_buffer);
+        console_free(console, console->read_buffer);
+        console_free(console, console->argv);
+        console_free(console, console->arg_line);
+        console_free(console, (void *) console->prompt);
+        // Pool commands that are still allocated keep a heap pool alive
+        if((NULL != console->pool)
+            && (0 < console->pool->taken)
+            && (NULL == console->arena.base)) {
+            console->pool->f_orphaned = true;
+        } else {
+            console_free(console, console->pool);
+        }
+        console_free(console, console->rx_ring);
+        console_free(console, console->history);
+        console_free(console, console->tx_queue);
+        #if ECDC_ENABLE_TRACE
+        console_free(console, console->trace);
+        #endif /* ECDC_ENABLE_TRACE */
+        console_free(console, console);
+    }
+}
+
+static size_t
+pump_console(struct ecdc_console * console,
+             size_t max_bytes,
+             ecdc_deadline_fn deadline_fn)
+{
+    #if ECDC_ENABLE_STATS
+    unsigned long start_ticks = (NULL != console->stats_clock)
+        ? console->stats_clock(console->hint)
+        : 0;
+    #endif /* ECDC_ENABLE_STATS */
+
+    console->f_in_pump = true;
+    console->budget = max_bytes;
+    console->f_input_eof = false;
+
+    if(NULL != console->tx_queue) {
+        tx_queue_drain(console);
+    }
+
+    for(;;) {
+        // Let the transport catch up before doing more work. Fed input
+        // can't be held, so it is always processed
+        if(!console->f_feeding && tx_queue_is_congested(console)) {
+            break;
+        }
+
+        console->state(console);
+
+        // A resumable command did one step
+        if(console->f_yield) {
+            console->f_yield = false;
+            break;
+        }
+
+        // Keep going while the state machine has work that doesn't need
+        // input, or there may be input left to process within the budget. A
+        // snooped character was already paid for
+        bool has_work = !state_is_reading(console->state)
+            || (ECDC_GETC_EOF != console->snoop_char)
+            || ((0 < console->budget)
+                && ((0 < console->rx_len) || !console->f_input_eof));
+        if(!has_work) {
+            break;
+        }
+
+        if((NULL != deadline_fn) && deadline_fn(console->hint)) {
+            break;
+        }
+    }
+
+    // Report what is known to be left. If the pump stopped early without
+    // anything buffered, there may still be more, so report at least 1
+    size_t pending = term_buffered_input(console);
+    if((0 == pending)
+        && (!console->f_input_eof || !state_is_reading(console->state))) {
+        pending = 1;
+    }
+
+    if(NULL != console->rx_ring) {
+        term_release_ring_window(console);
+    }
+
+    console->f_in_pump = false;
+    term_flush(console);
+
+    #if ECDC_ENABLE_STATS
+    if(NULL != console->stats_clock) {
+        unsigned long ticks = console->stats_clock(console->hint) - start_ticks;
+        if(ticks > console->stats.max_pump_ticks) {
+            console->stats.max_pump_ticks = ticks;
+        }
+    }
+    #endif /* ECDC_ENABLE_STATS */
+
+    return pending;
+}
+
+size_t
+ecdc_pump_console_budget(struct ecdc_console * console,
+                         size_t max_bytes,
+                         ecdc_deadline_fn deadline_fn)
+{
+    size_t pending = 0;
+    if(NULL != console) {
+        pending = pump_console(console, max_bytes, deadline_fn);
+    }
+    return pending;
+}
+
+size_t
+ecdc_feed(struct ecdc_console * console,
+          const char * buf,
+          size_t len)
+{
+    if((NULL == console) || (NULL == buf) || console->f_in_pump) {
+        return 0;
+    }
+
+    size_t consumed = 0;
+
+    // The transport is not polled while feeding, so every pump below runs
+    // until its window is used up, or a resumable command yields
+    console->f_feeding = true;
+
+    do {
+        // Anything left over from a bulk read came first
+        while((0 < console->rx_len) && (NULL == console->running)) {
+            (void) pump_console(console, (size_t) -1, NULL);
+        }
+        if(NULL != console->rx_ring) {
+            term_release_ring_window(console);
+        }
+        if(0 < console->rx_len) {
+            break;
+        }
+
+        // Process straight out of the caller's buffer. A running command
+        // gets its step first, and what is left is handed back
+        console->rx_ptr = buf;
+        console->rx_len = len;
+        do {
+            (void) pump_console(console, (size_t) -1, NULL);
+        } while((0 < console->rx_len) && (NULL == console->running));
+
+        consumed = len - console->rx_len;
+        STATS_ADD(console, bytes_received, consumed);
+        console->rx_ptr = NULL;
+        console->rx_len = 0;
+    } while(0);
+
+    console->f_feeding = false;
+    return consumed;
+}
+
+void
+ecdc_pump_console(struct ecdc_console * console)
+{
+    if(NULL != console)
+    {
+        size_t budget = ((NULL != console->read) || (NULL != console->rx_ring))
+            ? ((size_t) -1)
+            : DEFAULT_PUMP_BUDGET;
+        (void) ecdc_pump_console_budget(console, budget, NULL);
+    }
+}
+
+void
+ecdc_configure_console(struct ecdc_console * console,
+                       enum ecdc_mode mode,
+                       int flags)
+{
+    if(NULL != console) {
+        // Input that was being read switches over to the new mode
+        if((mode != console->mode)
+            && state_is_reading(console->state)
+            && (state_wait_for_client != console->state))
+        {
+            console->state = state_start_new_command;
+        }
+        console->mode = mode;
+
+        console->f_local_echo = (ECDC_SET_LOCAL_ECHO & flags) ? true : false;
+        console->f_prefix_match = (ECDC_SET_PREFIX_MATCH & flags) ? true : false;
+        console->f_batch_control = (ECDC_SET_BATCH_CONTROL & flags) ? true : false;
+    }
+}
+
+void
+ecdc_begin_batch(struct ecdc_console * console)
+{
+    if(NULL != console) {
+        batch_begin(console);
+    }
+}
+
+void
+ecdc_end_batch(struct ecdc_console * console)
+{
+    if(NULL != console) {
+        batch_end(console);
+
+        if(!console->f_in_pump) {
+            term_flush(console);
+        }
+    }
+}
+
+void
+ecdc_replace_prompt(struct ecdc_console *console,
+                    char const *prompt)
+{
+    if(NULL != console) {
+        // If the prompt was previously not set, it will be NULL which will not
+        // have any ill side effects when calling free
+        console_free(console, (void *) console->prompt);
+
+        if((NULL != prompt) && (NULL == console->arena.base)) {
+            console->prompt = ecdc_strdup(prompt);
+        } else {
+            console->prompt = prompt;
+        }
+    }
+}
+
+int
+ecdc_alloc_output_buffer(struct ecdc_console * console,
+                         size_t size)
+{
+    int ret = -1;
+
+    if(NULL != console) {
+        term_flush(console);
+
+        console_free(console, console->tx_buffer);
+        console->tx_buffer = NULL;
+        console->tx_buffer_size = 0;
+        console->tx_reserved = 0;
+
+        if(0 == size) {
+            ret = 0;
+        } else {
+            console->tx_buffer = (char *) console_alloc(console, size);
+            if(NULL != console->tx_buffer) {
+                console->tx_buffer_size = size;
+                ret = 0;
+            }
+        }
+    }
+
+    return ret;
+}
+
+int
+ecdc_alloc_history(struct ecdc_console * console,
+                   size_t size)
+{
+    int ret = -1;
+
+    do {
+        if((NULL == console) || (NULL != console->history)) {
+            break;
+        }
+
+        if(size <= HISTORY_FRAME_SIZE) {
+            break;
+        }
+
+        struct history * history = (struct history *)
+            console_alloc(console, sizeof(struct history) + size);
+        if(NULL == history) {
+            break;
+        }
+
+        history->data = (char *) (history + 1);
+        history->size = size;
+        history->used = 0;
+        history->head = 0;
+        history->tail = 0;
+        history->cursor = 0;
+        history->f_browsing = false;
+
+        console->history = history;
+        ret = 0;
+    } while(0);
+
+    return ret;
+}
+
+static struct ecdc_command *
+create_command(struct storage_arena * arena,
+               void * command_hint,
+               struct ecdc_console * console,
+               const char * command_name,
+               ecdc_callback_fn callback,
+               ecdc_resumable_fn resumable)
+{
+    struct ecdc_command * command = NULL;
+
+    do {
+        if(NULL == command_name) {
+            break;
+        }
+
+        // Exactly one kind of callback
+        if((NULL == callback) == (NULL == resumable)) {
+            break;
+        }
+
+        if(NULL != locate_command(console, command_name)) {
+            break;
+        }
+
+        if(NULL != locate_static_command(command_name)) {
+            break;
+        }
+
+        size_t name_size = strlen(command_name) + 1;
+        enum command_storage storage;
+        if(NULL != arena) {
+            command = (struct ecdc_command *)
+                arena_alloc(arena, sizeof(struct ecdc_command) + name_size);
+            storage = COMMAND_STORAGE_CALLER;
+        } else {
+            command = pool_take((NULL != console) ? console->pool : NULL,
+                                name_size);
+            storage = COMMAND_STORAGE_POOL;
+
+            // Fall back to the heap, unless the console itself is not allowed
+            // to use it
+            if((NULL == command)
+                && ((NULL == console) || (NULL == console->arena.base))) {
+                command = (struct ecdc_command *)
+                    malloc(sizeof(struct ecdc_command) + name_size);
+                storage = COMMAND_STORAGE_HEAP;
+            }
+        }
+        if(NULL == command) {
+            break;
+        }
+
+        command->console = NULL;
+        command->next = NULL;
+        command->prev = NULL;
+        command->callback = callback;
+        command->resumable = resumable;
+        command->hint = command_hint;
+        command->storage = storage;
+        command->pool = (COMMAND_STORAGE_POOL == storage) ? console->pool : NULL;
+        command->group = 0;
+        #if ECDC_ENABLE_PROFILER
+        memset(&command->profile, 0, sizeof(command->profile));
+        #endif /* ECDC_ENABLE_PROFILER */
+        memcpy(command->name, command_name, name_size);
+
+        register_command(console, command);
+    } while(0);
+
+    return command;
+}
+
+int
+ecdc_alloc_command_pool(struct ecdc_console * console,
+                        size_t command_count,
+                        size_t max_name_length)
+{
+    int ret = -1;
+
+    do {
+        if((NULL == console) || (NULL != console->pool) || (0 == command_count)) {
+            break;
+        }
+
+        // Round the header and slots up so that every command in the pool
+        // is aligned
+        size_t header_size = ECDC_STORAGE_ROUND_UP(sizeof(struct command_pool));
+        size_t slot_size = ECDC_STORAGE_ROUND_UP(
+            sizeof(struct ecdc_command) + max_name_length + 1);
+
+        struct command_pool * pool = (struct command_pool *)
+            console_alloc(console, header_size + (slot_size * command_count));
+        if(NULL == pool) {
+            break;
+        }
+
+        pool->free = NULL;
+        pool->max_name_size = max_name_length + 1;
+        pool->taken = 0;
+        pool->f_orphaned = false;
+
+        char * slots = (char *) pool + header_size;
+        size_t i = command_count;
+        while(i > 0) {
+            --i;
+            pool_release(pool, (struct ecdc_command *) &slots[i * slot_size]);
+        }
+
+        console->pool = pool;
+
+        ret = 0;
+    } while(0);
+
+    return ret;
+}
+
+int
+ecdc_alloc_rx_ring(struct ecdc_console * console,
+                   size_t size)
+{
+    int ret = -1;
+
+    do {
+        if((NULL == console) || (NULL != console->rx_ring)) {
+            break;
+        }
+
+        if((0 == size) || (0 != (size & (size - 1)))) {
+            // Not a power of two
+            break;
+        }
+
+        struct rx_ring * ring = (struct rx_ring *)
+            console_alloc(console, sizeof(struct rx_ring) + size);
+        if(NULL == ring) {
+            break;
+        }
+
+        RING_INIT(&ring->producer.p.head, 0);
+        RING_INIT(&ring->producer.p.overflow, 0);
+        RING_INIT(&ring->consumer.c.tail, 0);
+        ring->mask = size - 1;
+        ring->data = (char *) (ring + 1);
+
+        console->rx_ring = ring;
+        ret = 0;
+    } while(0);
+
+    return ret;
+}
+
+size_t
+ecdc_rx_isr_push(struct ecdc_console * console,
+                 const char * buf,
+                 size_t len)
+{
+    if((NULL == console) || (NULL == console->rx_ring) || (NULL == buf)) {
+        return 0;
+    }
+
+    struct rx_ring * ring = console->rx_ring;
+    size_t head = RING_LOAD_RELAXED(&ring->producer.p.head);
+    size_t tail = RING_LOAD_ACQUIRE(&ring->consumer.c.tail);
+    size_t space = ring->mask + 1 - (head - tail);
+
+    size_t count = (len < space) ? len : space;
+    if(count < len) {
+        size_t overflow = RING_LOAD_RELAXED(&ring->producer.p.overflow);
+        RING_STORE_RELAXED(&ring->producer.p.overflow, overflow + (len - count));
+    }
+
+    // Copy in up to two chunks, around the end of the ring
+    size_t offset = head & ring->mask;
+    size_t first = ring->mask + 1 - offset;
+    if(first > count) {
+        first = count;
+    }
+    memcpy(&ring->data[offset], buf, first);
+    memcpy(&ring->data[0], &buf[first], count - first);
+
+    RING_STORE_RELEASE(&ring->producer.p.head, head + count);
+    return count;
+}
+
+size_t
+ecdc_rx_overflow_count(struct ecdc_console * console)
+{
+    size_t count = 0;
+    if((NULL != console) && (NULL != console->rx_ring)) {
+        count = RING_LOAD_RELAXED(&console->rx_ring->producer.p.overflow);
+    }
+    return count;
+}
+
+#if ECDC_ENABLE_REGISTRY
+struct ecdc_registry *
+ecdc_alloc_registry(size_t max_readers)
+{
+    struct ecdc_registry * registry =
+        (struct ecdc_registry *) malloc(sizeof(struct ecdc_registry));
+    if(NULL == registry) {
+        goto out;
+    }
+
+    if(max_readers < 1) {
+        max_readers = 1;
+    }
+
+    registry->readers = (union registry_reader *)
+        malloc(sizeof(union registry_reader) * max_readers);
+    if(NULL == registry->readers) {
+        goto out_readers_fail;
+    }
+
+    size_t i;
+    for(i = 0; i < max_readers; ++i) {
+        PTR_INIT(&registry->readers[i].r.hazard, NULL);
+        registry->readers[i].r.used = false;
+    }
+    registry->reader_count = max_readers;
+
+    PTR_INIT(&registry->current, NULL);
+    SPIN_LOCK_INIT(&registry->write_lock);
+    registry->retired = NULL;
+
+    // Success
+    goto out;
+
+    out_readers_fail:
+        free(registry);
+        registry = NULL;
+
+    out:
+        return registry;
+}
+
+void
+ecdc_free_registry(struct ecdc_registry * registry)
+{
+    if(NULL != registry) {
+        while(NULL != registry->retired) {
+            struct registry_snapshot * snapshot = registry->retired;
+            registry->retired = snapshot->next_retired;
+            free(snapshot);
+        }
+
+        free(PTR_LOAD_ACQUIRE(&registry->current));
+        free(registry->readers);
+        free(registry);
+    }
+}
+
+int
+ecdc_registry_add(struct ecdc_registry * registry,
+                  const char * command_name,
+                  ecdc_callback_fn callback,
+                  void * command_hint)
+{
+    int ret = -1;
+
+    if((NULL == registry) || (NULL == command_name) || (NULL == callback)) {
+        return ret;
+    }
+
+    SPIN_LOCK(&registry->write_lock);
+
+    const struct registry_snapshot * old = (const struct registry_snapshot *)
+        PTR_LOAD_ACQUIRE(&registry->current);
+
+    size_t position;
+    if(NULL == snapshot_search(old, command_name, &position)) {
+        struct registry_entry add = { command_name, callback, command_hint };
+        struct registry_snapshot * snapshot =
+            snapshot_copy(old, &add, position, false);
+        if(NULL != snapshot) {
+            registry_publish(registry, snapshot);
+            ret = 0;
+        }
+    }
+
+    SPIN_UNLOCK(&registry->write_lock);
+    return ret;
+}
+
+int
+ecdc_registry_remove(struct ecdc_registry * registry,
+                     const char * command_name)
+{
+    int ret = -1;
+
+    if((NULL == registry) || (NULL == command_name)) {
+        return ret;
+    }
+
+    SPIN_LOCK(&registry->write_lock);
+
+    const struct registry_snapshot * old = (const struct registry_snapshot *)
+        PTR_LOAD_ACQUIRE(&registry->current);
+
+    size_t position;
+    if(NULL != snapshot_search(old, command_name, &position)) {
+        struct registry_snapshot * snapshot =
+            snapshot_copy(old, NULL, position, true);
+        if(NULL != snapshot) {
+            registry_publish(registry, snapshot);
+            ret = 0;
+        }
+    }
+
+    SPIN_UNLOCK(&registry->write_lock);
+    return ret;
+}
+
+int
+ecdc_attach_registry(struct ecdc_console * console,
+                     struct ecdc_registry * registry)
+{
+    int ret = -1;
+
+    if((NULL == console) || (NULL == registry) || (NULL != console->registry)) {
+        return ret;
+    }
+
+    SPIN_LOCK(&registry->write_lock);
+
+    size_t i;
+    for(i = 0; i < registry->reader_count; ++i) {
+        if(!registry->readers[i].r.used) {
+            registry->readers[i].r.used = true;
+            console->registry = registry;
+            console->registry_slot = i;
+            ret = 0;
+            break;
+        }
+    }
+
+    SPIN_UNLOCK(&registry->write_lock);
+    return ret;
+}
+
+void
+ecdc_detach_registry(struct ecdc_console * console)
+{
+    if((NULL == console) || (NULL == console->registry)) {
+        return;
+    }
+
+    struct ecdc_registry * registry = console->registry;
+    SPIN_LOCK(&registry->write_lock);
+
+    registry->readers[console->registry_slot].r.used = false;
+    console->registry = NULL;
+    console->registry_slot = 0;
+
+    SPIN_UNLOCK(&registry->write_lock);
+}
+#endif /* ECDC_ENABLE_REGISTRY */
+
+struct ecdc_command *
+ecdc_alloc_command(void * command_hint,
+                   struct ecdc_console * console,
+                   const char * command_name,
+                   ecdc_callback_fn callback)
+{
+    return create_command(NULL,
+                          command_hint,
+                          console,
+                          command_name,
+                          callback,
+                          NULL);
+}
+
+struct ecdc_command *
+ecdc_init_command(void * storage,
+                  size_t storage_size,
+                  void * command_hint,
+                  struct ecdc_console * console,
+                  const char * command_name,
+                  ecdc_callback_fn callback)
+{
+    struct ecdc_command * command = NULL;
+    if(NULL != storage) {
+        struct storage_arena arena = { (char *) storage, storage_size, 0 };
+        command = create_command(&arena,
+                                 command_hint,
+                                 console,
+                                 command_name,
+                                 callback,
+                                 NULL);
+    }
+    return command;
+}
+
+struct ecdc_command *
+ecdc_alloc_resumable_command(void * command_hint,
+                             struct ecdc_console * console,
+                             const char * command_name,
+                             ecdc_resumable_fn callback)
+{
+    return create_command(NULL,
+                          command_hint,
+                          console,
+                          command_name,
+                          NULL,
+                          callback);
+}
+
+struct ecdc_command *
+ecdc_init_resumable_command(void * storage,
+                            size_t storage_size,
+                            void * command_hint,
+                            struct ecdc_console * console,
+                            const char * command_name,
+                            ecdc_resumable_fn callback)
+{
+    struct ecdc_command * command = NULL;
+    if(NULL != storage) {
+        struct storage_arena arena = { (char *) storage, storage_size, 0 };
+        command = create_command(&arena,
+                                 command_hint,
+                                 console,
+                                 command_name,
+                                 NULL,
+                                 callback);
+    }
+    return command;
+}
+
+void
+ecdc_free_command(struct ecdc_command * command)
+{
+    if(NULL != command) {
+        unregister_command(command);
+        release_command(command);
+    }
+}
+
+void
+ecdc_set_command_group(struct ecdc_command * command,
+                       int group)
+{
+    if(NULL != command) {
+        command->group = group;
+    }
+}
+
+void
+ecdc_free_command_group(struct ecdc_console * console,
+                        int group)
+{
+    if(NULL == console) {
+        return;
+    }
+
+    // Drop the whole group from the index in one pass, instead of a search
+    // and a move for every command
+    if(console->f_index_valid) {
+        size_t read_index;
+        size_t write_index = 0;
+        for(read_index = 0; read_index < console->index_count; ++read_index) {
+            struct ecdc_command * command = console->index[read_index];
+            if(group != command->group) {
+                console->index[write_index] = command;
+                ++write_index;
             }
         }
+        console->index_count = write_index;
+    }
 
-        if(local_echo) {
-            term_putc_raw(console, in);
+    struct ecdc_command * command = console->root;
+    while(NULL != command) {
+        struct ecdc_command * next = command->next;
+        if(group == command->group) {
+            list_unlink(console, command);
+
+            // A running command is dropped, the console moves on next pump
+            if(command == console->running) {
+                console->running = NULL;
+            }
+            release_command(command);
         }
+        command = next;
     }
+
+    if(!console->f_index_valid) {
+        index_revalidate_if_empty(console);
+    }
+}
+
+struct ecdc_command *
+ecdc_alloc_list_command(struct ecdc_console * console,
+                        const char * command_name)
+{
+    return ecdc_alloc_command(console,
+                              console,
+                              command_name,
+                              built_in_list_command);
+}
+
+struct ecdc_command *
+ecdc_init_list_command(void * storage,
+                       size_t storage_size,
+                       struct ecdc_console * console,
+                       const char * command_name)
+{
+    return ecdc_init_command(storage,
+                             storage_size,
+                             console,
+                             console,
+                             command_name,
+                             built_in_list_command);
 }
 
-static void
-state_start_new_command(struct ecdc_console * console)
+#if ECDC_ENABLE_STATS
+struct ecdc_command *
+ecdc_alloc_stats_command(struct ecdc_console * console,
+                         const char * command_name)
 {
-    // Clear input string
-    console->arg_line_write_index = 0;
+    return ecdc_alloc_command(console,
+                              console,
+                              command_name,
+                              built_in_stats_command);
+}
 
-    // Clear argv
-    {
-        size_t i;
-        for(i = 0; i < console->max_argc; ++i) {
-            console->argv[i] = NULL;
-        }
-    }
+struct ecdc_command *
+ecdc_init_stats_command(void * storage,
+                        size_t storage_size,
+                        struct ecdc_console * console,
+                        const char * command_name)
+{
+    return ecdc_init_command(storage,
+                             storage_size,
+                             console,
+                             console,
+                             command_name,
+                             built_in_stats_command);
+}
 
-    // Set new state to read user input
-    if(NULL == console->prompt)
-    {
-        term_puts_raw(console, DEFAULT_PROMPT,
-            sizeof(DEFAULT_PROMPT) / sizeof(*DEFAULT_PROMPT));
+void
+ecdc_set_stats_clock(struct ecdc_console * console,
+                     ecdc_clock_fn clock_fn)
+{
+    if(NULL != console) {
+        console->stats_clock = clock_fn;
     }
-    else
-    {
-        term_puts(console, console->prompt);
+}
+
+int
+ecdc_get_stats(struct ecdc_console * console,
+               struct ecdc_stats * stats)
+{
+    if((NULL == console) || (NULL == stats)) {
+        return -1;
     }
 
-    console->state = state_read_input;
+    *stats = console->stats;
+    return 0;
 }
 
-static void
-state_wait_for_client(struct ecdc_console * console)
+void
+ecdc_reset_stats(struct ecdc_console * console)
 {
-    int in = term_getc_raw(console);
-    if(ECDC_GETC_EOF != in) {
-        term_set_snoop_char(console, in);
-        console->state = state_start_new_command;
+    if(NULL != console) {
+        memset(&console->stats, 0, sizeof(console->stats));
     }
 }
+#endif /* ECDC_ENABLE_STATS */
 
+#if ECDC_ENABLE_PROFILER
+struct ecdc_command *
+ecdc_alloc_profile_command(struct ecdc_console * console,
+                           const char * command_name)
+{
+    return ecdc_alloc_command(console,
+                              console,
+                              command_name,
+                              built_in_profile_command);
+}
 
-// ---------------------------------------------------------- Build in commands
+struct ecdc_command *
+ecdc_init_profile_command(void * storage,
+                          size_t storage_size,
+                          struct ecdc_console * console,
+                          const char * command_name)
+{
+    return ecdc_init_command(storage,
+                             storage_size,
+                             console,
+                             console,
+                             command_name,
+                             built_in_profile_command);
+}
 
-static void
-built_in_list_command(void * hint, int argc, char const * argv[])
+void
+ecdc_set_profile_clock(struct ecdc_console * console,
+                       ecdc_clock_fn clock_fn)
 {
-    (void) argc;
-    (void) argv;
+    if(NULL != console) {
+        console->profile_clock = clock_fn;
+    }
+}
 
-    struct ecdc_console * console = (struct ecdc_console *) hint;
+int
+ecdc_get_profile(struct ecdc_command * command,
+                 struct ecdc_profile * profile)
+{
+    if((NULL == command) || (NULL == profile)) {
+        return -1;
+    }
 
-    struct ecdc_command * command;
-    for(command = console->root; NULL != command; command = command->next) {
-        term_puts(console, command->name);
-        term_put_newline(console);
+    *profile = command->profile;
+    return 0;
+}
+
+void
+ecdc_reset_profiles(struct ecdc_console * console)
+{
+    if(NULL != console) {
+        struct ecdc_command * command;
+        for(command = console->root; NULL != command; command = command->next) {
+            memset(&command->profile, 0, sizeof(command->profile));
+        }
     }
 }
+#endif /* ECDC_ENABLE_PROFILER */
 
+#if ECDC_ENABLE_TRACE
+struct ecdc_command *
+ecdc_alloc_trace_command(struct ecdc_console * console,
+                         const char * command_name)
+{
+    return ecdc_alloc_command(console,
+                              console,
+                              command_name,
+                              built_in_trace_command);
+}
 
-// ----------------------------------------------------------- Public functions
+struct ecdc_command *
+ecdc_init_trace_command(void * storage,
+                        size_t storage_size,
+                        struct ecdc_console * console,
+                        const char * command_name)
+{
+    return ecdc_init_command(storage,
+                             storage_size,
+                             console,
+                             console,
+                             command_name,
+                             built_in_trace_command);
+}
 
-struct ecdc_console *
-ecdc_alloc_console(void * console_hint,
-                   ecdc_getc_fn getc_fn,
-                   ecdc_puts_fn puts_fn,
-                   size_t max_arg_line_length,
-                   size_t max_arg_count)
+int
+ecdc_alloc_trace(struct ecdc_console * console,
+                 size_t entries)
 {
-    struct ecdc_console * console =
-        (struct ecdc_console *) malloc(sizeof(struct ecdc_console));
-    if(NULL == console) {
-        goto out;
-    }
+    int ret = -1;
 
-    console->root = NULL;
-    console->getc = getc_fn;
-    console->puts = puts_fn;
-    console->hint = console_hint;
-    console->snoop_char = ECDC_GETC_EOF;
-    console->state = state_wait_for_client;
-    console->prompt = NULL;
+    do {
+        if((NULL == console) || (NULL != console->trace)) {
+            break;
+        }
 
-    if(max_arg_line_length < 16) {
-        max_arg_line_length = 16;
-    }
-    console->arg_line_size = max_arg_line_length;
-    console->arg_line_write_index = 0;
+        if((0 == entries) || (0 != (entries & (entries - 1)))) {
+            // Not a power of two
+            break;
+        }
 
-    size_t alloc_size = (max_arg_line_length + 1) * sizeof(char);
-    console->arg_line = (char *) malloc(alloc_size);
-    if(NULL == console->arg_line) {
-        goto out_arg_line_fail;
-    }
+        struct trace_ring * ring = (struct trace_ring *)
+            console_alloc(console, sizeof(struct trace_ring)
+                                   + (entries * sizeof(struct ecdc_trace_entry)));
+        if(NULL == ring) {
+            break;
+        }
 
+        RING_INIT(&ring->head, 0);
+        ring->mask = entries - 1;
+        ring->entries = (struct ecdc_trace_entry *) (ring + 1);
 
-    if(max_arg_count < 1) {
-        max_arg_count = 1;
+        console->trace = ring;
+        ret = 0;
+    } while(0);
+
+    return ret;
+}
+
+void
+ecdc_set_trace_clock(struct ecdc_console * console,
+                     ecdc_clock_fn clock_fn)
+{
+    if(NULL != console) {
+        console->trace_clock = clock_fn;
     }
-    console->max_argc = max_arg_count;
+}
 
-    console->argv = (const char **) malloc(sizeof(char *) * max_arg_count);
-    if(NULL == console->argv) {
-        goto out_argv_fail;
+size_t
+ecdc_read_trace(const struct ecdc_console * console,
+                struct ecdc_trace_entry * entries,
+                size_t max_entries)
+{
+    if((NULL == console) || (NULL == console->trace) || (NULL == entries)) {
+        return 0;
+    }
+
+    // The slot after the head may be half overwritten, so skip it
+    struct trace_ring * ring = console->trace;
+    size_t head = RING_LOAD_ACQUIRE(&ring->head);
+    size_t count = (head < ring->mask) ? head : ring->mask;
+    if(count > max_entries) {
+        count = max_entries;
     }
 
     size_t i;
-    for(i = 0; i < max_arg_count; ++i) {
-        console->argv[i] = NULL;
+    for(i = 0; i < count; ++i) {
+        entries[i] = ring->entries[(head - count + i) & ring->mask];
     }
 
+    return count;
+}
+#endif /* ECDC_ENABLE_TRACE */
 
-    // Initialize control sequence
-    console->cs_write_index = 0;
-    for(i = 0; i < CS_BUFFER_SIZE; ++i) {
-        console->cs_buffer[i] = '\x00';
+void
+ecdc_putc(struct ecdc_console * console, char c)
+{
+    if(NULL != console) {
+        bool f_notify = frame_notify_begin(console);
+        term_putc(console, c);
+        if(f_notify) {
+            frame_end(console, ECDC_FRAME_STATUS_OK);
+        }
+
+        if(!console->f_in_pump) {
+            term_flush(console);
+        }
     }
+}
 
+void
+ecdc_puts(struct ecdc_console * console, const char * str)
+{
+    if(NULL != console) {
+        bool f_notify = frame_notify_begin(console);
+        term_puts(console, str);
+        if(f_notify) {
+            frame_end(console, ECDC_FRAME_STATUS_OK);
+        }
 
-    // Set default settings
-    ecdc_configure_console(console, ECDC_MODE_ANSI, ECDC_SET_LOCAL_ECHO);
+        if(!console->f_in_pump) {
+            term_flush(console);
+        }
+    }
+}
 
+int
+ecdc_vprintf(struct ecdc_console * console,
+             const char * format,
+             va_list args)
+{
+    if((NULL == console) || (NULL == format)) {
+        return -1;
+    }
 
-    // Success
-    goto out;
+    bool f_notify = frame_notify_begin(console);
+    int count = format_output(console, format, args);
+    if(f_notify) {
+        frame_end(console, ECDC_FRAME_STATUS_OK);
+    }
 
-    out_argv_fail:
-        free(console->arg_line);
+    if(!console->f_in_pump) {
+        term_flush(console);
+    }
 
-    out_arg_line_fail:
-        free(console);
-        console = NULL;
+    return count;
+}
 
-    out:
-        return console;
+int
+ecdc_printf(struct ecdc_console * console,
+            const char * format,
+            ...)
+{
+    va_list args;
+    va_start(args, format);
+    int count = ecdc_vprintf(console, format, args);
+    va_end(args);
+
+    return count;
 }
 
 void
-ecdc_free_console(struct ecdc_console * console)
+ecdc_flush(struct ecdc_console * console)
 {
-    if(console != NULL) {
-        while(NULL != console->root) {
-            unregister_command(console->root);
-        }
+    if(NULL != console) {
+        term_flush(console);
 
-        free(console->argv);
-        free(console->arg_line);
-        free(console->prompt);
-        free(console);
+        if(NULL != console->tx_queue) {
+            tx_queue_drain(console);
+        }
     }
 }
 
-void
-ecdc_pump_console(struct ecdc_console * console)
+char *
+ecdc_out_reserve(struct ecdc_console * console,
+                 size_t size)
 {
-    if(NULL != console)
+    if((NULL == console)
+        || (NULL == console->tx_buffer)
+        || (size > console->tx_buffer_size))
     {
-        console->state(console);
+        return NULL;
     }
-}
 
-void
-ecdc_configure_console(struct ecdc_console * console,
-                       enum ecdc_mode mode,
-                       int flags)
-{
-    if(NULL != console) {
-        console->mode = mode;
+    // The response header has to go ahead of the reserved space
+    console->f_frame_notify = frame_notify_begin(console);
 
-        console->f_local_echo = (ECDC_SET_LOCAL_ECHO & flags) ? true : false;
+    if(size > (console->tx_buffer_size - console->tx_len)) {
+        term_flush(console);
     }
+
+    console->tx_reserved = size;
+    return &console->tx_buffer[console->tx_len];
 }
 
 void
-ecdc_replace_prompt(struct ecdc_console *console,
-                    char const *prompt)
+ecdc_out_commit(struct ecdc_console * console,
+                size_t used)
 {
-    if(NULL != console) {
-        // If the prompt was previously not set, it will be NULL which will not
-        // have any ill side effects when calling free
-        free(console->prompt);
+    if((NULL == console) || (0 == console->tx_reserved)) {
+        return;
+    }
 
-        if(NULL != prompt) {
-            console->prompt = ecdc_strdup(prompt);
+    if(used > console->tx_reserved) {
+        used = console->tx_reserved;
+    }
+    console->tx_reserved = 0;
+
+    // Translation only ever grows the output
+    const char * reserved = &console->tx_buffer[console->tx_len];
+    frame_checksum(console, reserved, used);
+    size_t growth = 0;
+    size_t i;
+    for(i = 0; i < used; ++i) {
+        size_t seq_len;
+        if(NULL != term_translation(console, reserved[i], &seq_len)) {
+            growth += seq_len - 1;
+        }
+    }
+
+    if((0 < growth)
+        && (growth > (console->tx_buffer_size - console->tx_len - used)))
+    {
+        // Make room by sending what came before
+        if(0 < console->tx_len) {
+            term_transmit(console, console->tx_buffer, console->tx_len);
+            memmove(console->tx_buffer,
+                    &console->tx_buffer[console->tx_len],
+                    used);
+            console->tx_len = 0;
+        }
+
+        if(growth > (console->tx_buffer_size - used)) {
+            // Still too big to translate in place
+            term_transmit_translated(console, console->tx_buffer, used);
+            used = 0;
+            growth = 0;
+        }
+    }
+
+    // Translate in place, back to front so nothing is overwritten early
+    char * out = &console->tx_buffer[console->tx_len];
+    size_t dst = used + growth;
+    i = used;
+    while(dst != i) {
+        --i;
+        size_t seq_len;
+        const char * seq = term_translation(console, out[i], &seq_len);
+        if(NULL != seq) {
+            dst -= seq_len;
+            memcpy(&out[dst], seq, seq_len);
         } else {
-            console->prompt = NULL;
+            out[--dst] = out[i];
         }
     }
+    console->tx_len += used + growth;
+
+    if(console->f_frame_notify) {
+        console->f_frame_notify = false;
+        frame_end(console, ECDC_FRAME_STATUS_OK);
+    }
+
+    if(!console->f_in_pump) {
+        term_flush(console);
+    }
 }
 
-struct ecdc_command *
-ecdc_alloc_command(void * command_hint,
-                   struct ecdc_console * console,
-                   const char * command_name,
-                   ecdc_callback_fn callback)
+int
+ecdc_alloc_output_queue(struct ecdc_console * console,
+                        ecdc_write_fn write_fn,
+                        size_t size)
 {
-    struct ecdc_command * command = NULL;
+    int ret = -1;
 
     do {
-        if(NULL == command_name) {
+        if((NULL == console) || (NULL != console->tx_queue)) {
             break;
         }
 
-        if(NULL != locate_command(console, command_name)) {
+        if((NULL == write_fn) || (0 == size)) {
             break;
         }
 
-        command = (struct ecdc_command *) malloc(sizeof(struct ecdc_command));
-        if(NULL == command) {
+        struct tx_queue * queue = (struct tx_queue *)
+            console_alloc(console, sizeof(struct tx_queue) + size);
+        if(NULL == queue) {
             break;
         }
 
-        command->console = NULL;
-        command->next = NULL;
-        command->callback = callback;
-        command->hint = command_hint;
+        queue->data = (char *) (queue + 1);
+        queue->size = size;
+        queue->head = 0;
+        queue->len = 0;
+        queue->dropped = 0;
 
-        command->name = ecdc_strdup(command_name);
+        // Anything staged so far still goes through puts
+        term_flush(console);
 
-        register_command(console, command);
+        console->write = write_fn;
+        console->tx_queue = queue;
+        ret = 0;
     } while(0);
 
-    return command;
-}
-
-void
-ecdc_free_command(struct ecdc_command * command)
-{
-    if(NULL != command) {
-        unregister_command(command);
-
-        free(command->name);
-        free(command);
-    }
-}
-
-struct ecdc_command *
-ecdc_alloc_list_command(struct ecdc_console * console,
-                        const char * command_name)
-{
-    return ecdc_alloc_command(console,
-                              console,
-                              command_name,
-                              built_in_list_command);
+    return ret;
 }
 
-void
-ecdc_putc(struct ecdc_console * console, char c)
+size_t
+ecdc_output_queue_depth(struct ecdc_console * console)
 {
-    if(NULL != console) {
-        term_putc(console, c);
+    size_t depth = 0;
+    if((NULL != console) && (NULL != console->tx_queue)) {
+        depth = console->tx_queue->len;
     }
+    return depth;
 }
 
-void
-ecdc_puts(struct ecdc_console * console, const char * str)
+size_t
+ecdc_output_dropped_count(struct ecdc_console * console)
 {
-    if(NULL != console) {
-        term_puts(console, str);
+    size_t count = 0;
+    if((NULL != console) && (NULL != console->tx_queue)) {
+        count = console->tx_queue->dropped;
     }
+    return count;
 }
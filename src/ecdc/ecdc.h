@@ -27,6 +27,7 @@
 extern "C" {
 #endif /* __cplusplus */
 
+#include <stdarg.h>
 #include <stddef.h>
 
 
@@ -39,20 +40,228 @@ extern "C" {
 
 // ---------------- Configuration modes
 enum ecdc_mode {
-    ECDC_MODE_ANSI              = 0
+    ECDC_MODE_ANSI              = 0,
+
+    // Binary protocol for machine clients, see below
+    ECDC_MODE_FRAMED            = 1
 };
 
 
+// ------------------------ Framed mode
+// Requests and responses are SLIP framed (RFC 1055). Each frame is sent
+// between END bytes, and END and ESC bytes inside of it are sent as ESC 0xDC
+// and ESC 0xDD. Once unescaped, frames are
+//
+//      Request:    [id:2] [command line] [crc:2]
+//      Response:   [id:2] [output] [status:1] [crc:2]
+//
+// with fields high byte first. The CRC is CRC-16/XMODEM (polynomial 0x1021,
+// initial value 0) of everything before it. Arguments in the command line are
+// separated by whitespace or NUL, as typed. Requests with a bad CRC are
+// dropped, there is no echo and no prompt, and output is sent untranslated.
+// Responses are sent in request order, and output written outside of a
+// command goes out with the notify ID
+#define ECDC_FRAME_END              0xC0
+#define ECDC_FRAME_ESC              0xDB
+
+#define ECDC_FRAME_ID_NOTIFY        0xFFFF
+
+#define ECDC_FRAME_STATUS_OK        0
+#define ECDC_FRAME_STATUS_NOT_FOUND 1
+#define ECDC_FRAME_STATUS_OVERFLOW  2
+
+
 // ---------------- Configuration flags
 
 // Enable local echo
 #define ECDC_SET_LOCAL_ECHO     (1 << 0)
 
+// Run a command when the name typed is a unique prefix of its name
+#define ECDC_SET_PREFIX_MATCH   (1 << 1)
+
+// Start and end batch mode when ECDC_BATCH_BEGIN and ECDC_BATCH_END arrive
+#define ECDC_SET_BATCH_CONTROL  (1 << 2)
+
+
+// ------------ Batch mode control bytes
+
+// STX and ETX start and end batch mode when ECDC_SET_BATCH_CONTROL is set,
+// see ecdc_begin_batch
+#define ECDC_BATCH_BEGIN        '\x02'
+#define ECDC_BATCH_END          '\x03'
+
 
 // --------- Internal console structure
 struct ecdc_console;
 
 
+// ----------- Caller provided storage
+
+// Alignment of buffers carved out of caller provided storage
+typedef union {
+    void *                              p;
+    void                                (*fn)(void);
+    long long                           ll;
+    double                              d;
+} ecdc_storage_align_t;
+
+#define ECDC_STORAGE_ALIGNMENT          (sizeof(ecdc_storage_align_t))
+
+#define ECDC_STORAGE_ROUND_UP(size)                                           \
+    ((((size) + ECDC_STORAGE_ALIGNMENT - 1) / ECDC_STORAGE_ALIGNMENT)         \
+        * ECDC_STORAGE_ALIGNMENT)
+
+// Cache line size used to keep the receive ring indices apart. This can be set
+// to the pointer size on parts without a data cache to save RAM
+#ifndef ECDC_CACHE_LINE_SIZE
+#define ECDC_CACHE_LINE_SIZE            64
+#endif
+
+// Per-console statistics counters. Define ECDC_ENABLE_STATS to 1 to enable
+// them, otherwise they are compiled out
+#ifndef ECDC_ENABLE_STATS
+#define ECDC_ENABLE_STATS               0
+#endif
+
+#if ECDC_ENABLE_STATS
+#  define ECDC_STATS_STRUCT_SIZE        (sizeof(struct ecdc_stats)            \
+                                            + sizeof(void *))
+#else
+#  define ECDC_STATS_STRUCT_SIZE        0
+#endif
+
+// Per-command execution profiles. Define ECDC_ENABLE_PROFILER to 1 to enable
+// them, otherwise they are compiled out. The histogram has
+// ECDC_PROFILE_BUCKETS log2 buckets, the first of which is for calls shorter
+// than 2^(ECDC_PROFILE_MIN_LOG2 + 1) cycles
+#ifndef ECDC_ENABLE_PROFILER
+#define ECDC_ENABLE_PROFILER            0
+#endif
+
+#ifndef ECDC_PROFILE_BUCKETS
+#define ECDC_PROFILE_BUCKETS            16
+#endif
+
+#ifndef ECDC_PROFILE_MIN_LOG2
+#define ECDC_PROFILE_MIN_LOG2           6
+#endif
+
+#if ECDC_ENABLE_PROFILER
+#  define ECDC_PROFILE_STRUCT_SIZE      (sizeof(struct ecdc_profile))
+#else
+#  define ECDC_PROFILE_STRUCT_SIZE      0
+#endif
+
+// Event trace for post-mortem analysis. Define ECDC_ENABLE_TRACE to 1 to
+// enable it, otherwise it is compiled out
+#ifndef ECDC_ENABLE_TRACE
+#define ECDC_ENABLE_TRACE               0
+#endif
+
+// Upper bounds of the internal structure sizes. These are checked against the
+// real structures at compile time. The console also has fields that are the
+// same size on every target
+#define ECDC_CONSOLE_STRUCT_SIZE        (56 * sizeof(void *) + 96             \
+                                            + ECDC_STATS_STRUCT_SIZE)
+#define ECDC_COMMAND_STRUCT_SIZE        (9 * sizeof(void *)                   \
+                                            + ECDC_PROFILE_STRUCT_SIZE)
+#define ECDC_COMMAND_POOL_STRUCT_SIZE   (4 * sizeof(void *))
+#define ECDC_RX_RING_STRUCT_SIZE        (2 * ECDC_CACHE_LINE_SIZE             \
+                                            + 4 * sizeof(void *))
+#define ECDC_HISTORY_STRUCT_SIZE        (8 * sizeof(void *))
+#define ECDC_OUTPUT_QUEUE_STRUCT_SIZE   (6 * sizeof(void *))
+#define ECDC_TRACE_STRUCT_SIZE          (4 * sizeof(void *))
+
+/**
+ * @brief Storage needed for an optional console buffer
+ * @details Add this to ECDC_CONSOLE_STORAGE_SIZE for every buffer that is
+ *          allocated from the console's storage, such as the read buffer of
+ *          ecdc_init_console_bulk or an output buffer
+ *
+ * @param size Size of the buffer
+ */
+#define ECDC_BUFFER_STORAGE_SIZE(size)                                        \
+    ECDC_STORAGE_ROUND_UP(size)
+
+/**
+ * @brief Storage needed by ecdc_init_console
+ * @details The parameters match the parameters of ecdc_init_console
+ */
+#define ECDC_CONSOLE_STORAGE_SIZE(max_arg_line_length,                        \
+                                  max_arg_count,                              \
+                                  max_command_count)                          \
+    (ECDC_STORAGE_ALIGNMENT - 1                                               \
+        + ECDC_STORAGE_ROUND_UP(ECDC_CONSOLE_STRUCT_SIZE)                     \
+        + ECDC_STORAGE_ROUND_UP((max_arg_line_length) + 1)                    \
+        + ECDC_STORAGE_ROUND_UP((max_arg_count) * sizeof(char *))             \
+        + ECDC_STORAGE_ROUND_UP((max_command_count) * sizeof(void *)))
+
+/**
+ * @brief Storage needed by ecdc_init_command
+ *
+ * @param name_length Length of the command name, not including the '\0'
+ */
+#define ECDC_COMMAND_STORAGE_SIZE(name_length)                                \
+    (ECDC_STORAGE_ALIGNMENT - 1                                               \
+        + ECDC_STORAGE_ROUND_UP(ECDC_COMMAND_STRUCT_SIZE)                     \
+        + (name_length) + 1)
+
+/**
+ * @brief Storage needed by ecdc_alloc_rx_ring
+ * @details Add this to ECDC_CONSOLE_STORAGE_SIZE when the ring is allocated
+ *          from the console's storage
+ *
+ * @param size Size of the ring
+ */
+#define ECDC_RX_RING_STORAGE_SIZE(size)                                       \
+    ECDC_STORAGE_ROUND_UP(ECDC_RX_RING_STRUCT_SIZE + (size))
+
+/**
+ * @brief Storage needed by ecdc_alloc_history
+ * @details Add this to ECDC_CONSOLE_STORAGE_SIZE when the history is
+ *          allocated from the console's storage
+ *
+ * @param size Size of the history ring
+ */
+#define ECDC_HISTORY_STORAGE_SIZE(size)                                       \
+    ECDC_STORAGE_ROUND_UP(ECDC_HISTORY_STRUCT_SIZE + (size))
+
+/**
+ * @brief Storage needed by ecdc_alloc_output_queue
+ * @details Add this to ECDC_CONSOLE_STORAGE_SIZE when the queue is
+ *          allocated from the console's storage
+ *
+ * @param size Size of the output queue
+ */
+#define ECDC_OUTPUT_QUEUE_STORAGE_SIZE(size)                                  \
+    ECDC_STORAGE_ROUND_UP(ECDC_OUTPUT_QUEUE_STRUCT_SIZE + (size))
+
+/**
+ * @brief Storage needed by ecdc_alloc_trace
+ * @details Add this to ECDC_CONSOLE_STORAGE_SIZE when the trace is allocated
+ *          from the console's storage
+ *
+ * @param entries Number of entries in the trace
+ */
+#define ECDC_TRACE_STORAGE_SIZE(entries)                                      \
+    ECDC_STORAGE_ROUND_UP(ECDC_TRACE_STRUCT_SIZE                              \
+        + (entries) * sizeof(struct ecdc_trace_entry))
+
+/**
+ * @brief Storage needed by ecdc_alloc_command_pool
+ * @details Add this to ECDC_CONSOLE_STORAGE_SIZE when the pool is allocated
+ *          from the console's storage
+ *
+ * @param command_count Number of commands in the pool
+ * @param max_name_length Longest command name the pool can hold
+ */
+#define ECDC_COMMAND_POOL_STORAGE_SIZE(command_count, max_name_length)        \
+    (ECDC_STORAGE_ROUND_UP(ECDC_COMMAND_POOL_STRUCT_SIZE)                     \
+        + (ECDC_STORAGE_ROUND_UP(ECDC_COMMAND_STRUCT_SIZE                     \
+                                 + (max_name_length) + 1)                     \
+            * (command_count)))
+
+
 /**
  * @brief Function pointer prototype for non-blocking character reads
  * @details When the console is pumped, this is polled for incoming characters.
@@ -68,6 +277,24 @@ struct ecdc_console;
 typedef int (*ecdc_getc_fn)(void * console_hint);
 
 
+/**
+ * @brief Function pointer prototype for non-blocking bulk reads
+ * @details When the console is pumped, this is polled for incoming characters.
+ *          The implementation should copy as many pending characters as it
+ *          has (up to max) into buf, and return the number copied. If there
+ *          are no characters to read, then 0 should be returned.
+ *          It is expected that this is non-blocking
+ *
+ * @param console_hint Optional console hint parameter. This pointer may be
+ *          used for whatever the implementation wants (such as a this pointer,
+ *          or a buffer pointer)
+ * @param buf Buffer to copy the user input characters into
+ * @param max Size of buf
+ * @return Number of characters copied into buf
+ */
+typedef size_t (*ecdc_read_fn)(void * console_hint, char * buf, size_t max);
+
+
 /**
  * @brief Function pointer prototype for writing characters
  * @details It is expected that this is non-blocking
@@ -81,6 +308,21 @@ typedef int (*ecdc_getc_fn)(void * console_hint);
 typedef void (*ecdc_puts_fn)(void * console_hint, const char * s, size_t len);
 
 
+/**
+ * @brief Function pointer prototype for writing characters without blocking
+ * @details This is used instead of ecdc_puts_fn by a console with an output
+ *          queue. See ecdc_alloc_output_queue
+ *
+ * @param console_hint Optional console hint parameter
+ * @param s Characters to write
+ * @param len Number of characters in s
+ *
+ * @return Number of characters accepted, which may be less than len (down to
+ *          0) when the transport is busy
+ */
+typedef size_t (*ecdc_write_fn)(void * console_hint, const char * s, size_t len);
+
+
 /**
  * @brief Allocates a console structure on the heap
  * @details The console will be allocated with default settings and no
@@ -91,7 +333,8 @@ typedef void (*ecdc_puts_fn)(void * console_hint, const char * s, size_t len);
  *          functions will be called with this pointer. This pointer may be
  *          used for whatever the implementation wants (such as a this pointer,
  *          or a buffer pointer). Set to NULL if not used
- * @param getc_fn Character read function
+ * @param getc_fn Character read function. This may be NULL if all input is
+ *          pushed in with ecdc_feed
  * @param puts_fn Character string write function
  * @param max_arg_line_length Maximum length of an input line. This is the
  *          maximum size of the input line and its arguments. 80 characters is
@@ -111,6 +354,37 @@ ecdc_alloc_console(void * console_hint,
                    size_t max_arg_count);
 
 
+/**
+ * @brief Allocates a console structure on the heap that uses a bulk read
+ *          function for input
+ * @details This is the same as ecdc_alloc_console, except that input is
+ *          read in blocks through read_fn instead of one character at a time.
+ *          Every character from a block is processed in the same pump that
+ *          read it, so this is better suited for transports with a receive
+ *          FIFO or DMA buffer
+ *
+ * @param console_hint Optional console hint parameter. The read_fn and puts_fn
+ *          functions will be called with this pointer. Set to NULL if not used
+ * @param read_fn Bulk character read function
+ * @param puts_fn Character string write function
+ * @param max_arg_line_length Maximum length of an input line
+ * @param max_arg_count Maximum number of arguments allowed per command
+ * @param read_buffer_size Size of the buffer handed to read_fn. This should be
+ *          about the size of the transport's receive FIFO or DMA buffer. 64
+ *          characters is a sane default.
+ *
+ * @return Console pointer. It is the responsibility of the caller to deallocate
+ *          this with a call to ecdc_free_console.
+ */
+struct ecdc_console *
+ecdc_alloc_console_bulk(void * console_hint,
+                        ecdc_read_fn read_fn,
+                        ecdc_puts_fn puts_fn,
+                        size_t max_arg_line_length,
+                        size_t max_arg_count,
+                        size_t read_buffer_size);
+
+
 /**
  * @brief Deallocates a console
  * @details This will free all resources and unregistering all commands
@@ -121,6 +395,61 @@ void
 ecdc_free_console(struct ecdc_console * console);
 
 
+/**
+ * @brief Initializes a console in caller provided storage
+ * @details This is the same as ecdc_alloc_console, except that the console and
+ *          all of its buffers are carved out of storage instead of the heap.
+ *          A console initialized this way never uses the heap, and
+ *          ecdc_replace_prompt will keep a reference to the prompt instead of
+ *          copying it.
+ *          The storage needs to stay valid until ecdc_free_console is called
+ *
+ * @param storage Storage for the console. This does not need to be aligned
+ * @param storage_size Size of storage. ECDC_CONSOLE_STORAGE_SIZE will compute
+ *          the size needed for the given settings
+ * @param console_hint Optional console hint parameter
+ * @param getc_fn Character read function
+ * @param puts_fn Character string write function
+ * @param max_arg_line_length Maximum length of an input line
+ * @param max_arg_count Maximum number of arguments allowed per command
+ * @param max_command_count Number of commands to reserve lookup index space
+ *          for. If more commands than this are registered, lookups will fall
+ *          back to a linear search
+ *
+ * @return Console pointer, or NULL if storage is too small. The console should
+ *          still be released with ecdc_free_console
+ */
+struct ecdc_console *
+ecdc_init_console(void * storage,
+                  size_t storage_size,
+                  void * console_hint,
+                  ecdc_getc_fn getc_fn,
+                  ecdc_puts_fn puts_fn,
+                  size_t max_arg_line_length,
+                  size_t max_arg_count,
+                  size_t max_command_count);
+
+
+/**
+ * @brief Initializes a bulk read console in caller provided storage
+ * @details This is the same as ecdc_alloc_console_bulk, with the storage rules
+ *          of ecdc_init_console. The storage needs to include
+ *          ECDC_BUFFER_STORAGE_SIZE(read_buffer_size) for the read buffer
+ *
+ * @return Console pointer, or NULL if storage is too small
+ */
+struct ecdc_console *
+ecdc_init_console_bulk(void * storage,
+                       size_t storage_size,
+                       void * console_hint,
+                       ecdc_read_fn read_fn,
+                       ecdc_puts_fn puts_fn,
+                       size_t max_arg_line_length,
+                       size_t max_arg_count,
+                       size_t max_command_count,
+                       size_t read_buffer_size);
+
+
 /**
  * @brief Periodic call to drive character receiving and parsing
  * @details This needs to be periodically called to drive the receiving and
@@ -133,6 +462,201 @@ void
 ecdc_pump_console(struct ecdc_console * console);
 
 
+/**
+ * @brief Function pointer prototype for pump deadline checks
+ * @details This is polled between steps of ecdc_pump_console_budget, and
+ *          should be fast (such as comparing a cycle counter)
+ *
+ * @param console_hint Console hint parameter
+ * @return Non-zero when the pump should stop
+ */
+typedef int (*ecdc_deadline_fn)(void * console_hint);
+
+
+/**
+ * @brief Function pointer prototype for the statistics and profiler clocks
+ * @details This should be fast, such as reading a cycle counter or a
+ *          free running timer. It may wrap around
+ *
+ * @param console_hint Console hint parameter
+ * @return Current time in ticks
+ */
+typedef unsigned long (*ecdc_clock_fn)(void * console_hint);
+
+
+/**
+ * @brief Drives the console with a bound on the work done
+ * @details This is the same as ecdc_pump_console, except that the caller
+ *          chooses how many input characters may be processed, and may supply
+ *          a deadline. The console keeps processing input (including running
+ *          commands) until the budget is used up, there is no more input, or
+ *          the deadline passes. A command that has started is always run to
+ *          completion, so the deadline is checked between steps.
+ *          ecdc_pump_console is this with a default budget of 8 characters
+ *          for getc consoles, and no limit for consoles with a bulk read
+ *          function or receive ring
+ *
+ * @param ecdc_console Console to execute
+ * @param max_bytes Maximum number of input characters to process. Use
+ *          (size_t) -1 for no limit
+ * @param deadline_fn Optional deadline check. Set to NULL if not used
+ *
+ * @return 0 if the console ran out of input. Otherwise the number of input
+ *          characters known to be waiting, which is at least 1 if there may be
+ *          more work left
+ */
+size_t
+ecdc_pump_console_budget(struct ecdc_console * console,
+                         size_t max_bytes,
+                         ecdc_deadline_fn deadline_fn);
+
+
+/**
+ * @brief Pushes received characters into the console
+ * @details This is for interrupt or DMA driven designs, where the driver hands
+ *          over blocks of received characters instead of being polled. The
+ *          characters are processed inline, straight out of buf, and any
+ *          commands they complete are run before this returns. The transport
+ *          read function is not polled during the call.
+ *          A resumable command that is running, or that the characters start,
+ *          takes one step, and if it yields, this returns without processing
+ *          the rest. Feed the rest again once the console has been pumped
+ *          (see ecdc_pump_console) until the command is done.
+ *          This must not be called from inside a pump (including from a
+ *          command callback) or concurrently with one. To hand characters over
+ *          from an interrupt, see ecdc_rx_isr_push
+ *
+ * @param ecdc_console Console to feed
+ * @param buf Received characters. This is only used during the call
+ * @param len Number of characters in buf
+ *
+ * @return Number of characters consumed. This is len unless a resumable
+ *          command yielded
+ */
+size_t
+ecdc_feed(struct ecdc_console * console,
+          const char * buf,
+          size_t len);
+
+
+/**
+ * @brief Allocates a receive ring for the console
+ * @details The ring is a lock-free single producer, single consumer queue
+ *          between a receive interrupt (using ecdc_rx_isr_push) and the pump.
+ *          The pump processes received characters directly out of the ring,
+ *          before polling the console's read function.
+ *          For a console from ecdc_init_console, the ring is carved out of the
+ *          console's storage. The ring can only be allocated once, and should
+ *          be allocated before the interrupt is enabled
+ *
+ * @param ecdc_console Console to allocate the ring for
+ * @param size Size of the ring. This must be a power of two
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+ecdc_alloc_rx_ring(struct ecdc_console * console,
+                   size_t size);
+
+
+/**
+ * @brief Pushes received characters into the console's receive ring
+ * @details This is safe to call from an interrupt while the console is being
+ *          pumped, as long as there is only one producer. Characters that
+ *          don't fit are dropped and counted
+ *
+ * @param ecdc_console Console with a receive ring
+ * @param buf Received characters
+ * @param len Number of characters in buf
+ *
+ * @return Number of characters accepted
+ */
+size_t
+ecdc_rx_isr_push(struct ecdc_console * console,
+                 const char * buf,
+                 size_t len);
+
+
+/**
+ * @brief Returns the number of characters dropped by ecdc_rx_isr_push
+ *
+ * @param ecdc_console Console with a receive ring
+ *
+ * @return Number of dropped characters since the ring was allocated
+ */
+size_t
+ecdc_rx_overflow_count(struct ecdc_console * console);
+
+
+/**
+ * @brief Allocates a command history for the console
+ * @details Lines are saved to the history as they are run, and can be
+ *          recalled with the cursor up and down keys. The history is a single
+ *          ring of bytes; each line takes its length plus 4 bytes, and the
+ *          oldest lines are dropped to make room.
+ *          For a console from ecdc_init_console, the history is carved out of
+ *          the console's storage. The history can only be allocated once
+ *
+ * @param ecdc_console Console to allocate the history for
+ * @param size Size of the history ring, in bytes
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+ecdc_alloc_history(struct ecdc_console * console,
+                   size_t size);
+
+
+/**
+ * @brief Switches the console's output to a write function with a queue
+ * @details From then on, output goes to write_fn instead of the console's
+ *          puts_fn. Whatever write_fn doesn't accept is kept in a queue of
+ *          size bytes and retried, in order, on later writes, on every pump,
+ *          and on ecdc_flush. While the queue is more than half full the pump
+ *          stops processing input (and so echo and commands), until the
+ *          transport catches up. ecdc_feed can't hold input back, so it
+ *          keeps processing. Output that doesn't fit in the queue is dropped
+ *          and counted.
+ *          For a console from ecdc_init_console, the queue is carved out of
+ *          the console's storage. The queue can only be allocated once
+ *
+ * @param ecdc_console Console to modify
+ * @param write_fn Function that accepts as much output as it can
+ * @param size Size of the output queue
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+ecdc_alloc_output_queue(struct ecdc_console * console,
+                        ecdc_write_fn write_fn,
+                        size_t size);
+
+
+/**
+ * @brief Returns the number of characters waiting in the output queue
+ * @details Commands that produce a lot of output can check this to throttle
+ *          themselves
+ *
+ * @param ecdc_console Console with an output queue
+ *
+ * @return Queue depth, or 0 if there is no queue
+ */
+size_t
+ecdc_output_queue_depth(struct ecdc_console * console);
+
+
+/**
+ * @brief Returns the number of characters dropped because the output queue
+ *          was full
+ *
+ * @param ecdc_console Console with an output queue
+ *
+ * @return Number of dropped characters since the queue was allocated
+ */
+size_t
+ecdc_output_dropped_count(struct ecdc_console * console);
+
+
 /**
  * @brief Modifies the console's configuration
  * @details This is used to modify the control sequence standard (mode) used by
@@ -147,6 +671,39 @@ ecdc_configure_console(struct ecdc_console * console,
                        enum ecdc_mode mode,
                        int flags);
 
+/**
+ * @brief Starts batch mode
+ * @details Batch mode is for scripts that are pasted or sent to the console.
+ *          Each line is run as soon as its line ending (\r, \n, or \r\n)
+ *          arrives, without local echo, prompts, or error messages. Lines
+ *          that are not found, or that don't fit in the argument line, are
+ *          counted as failed. If the console is configured with
+ *          ECDC_SET_BATCH_CONTROL, batch mode can also be started by sending
+ *          ECDC_BATCH_BEGIN
+ *
+ * @param ecdc_console Console to use
+ */
+void
+ecdc_begin_batch(struct ecdc_console * console);
+
+
+/**
+ * @brief Ends batch mode
+ * @details A last line without a line ending is run, then one summary line
+ *          is written with the number of lines and failures, and the line
+ *          numbers of the first failures (counting from 1). For example
+ *
+ *              batch: 200 lines, 2 failed: 17 105
+ *
+ *          With ECDC_SET_BATCH_CONTROL, batch mode can also be ended by
+ *          sending ECDC_BATCH_END
+ *
+ * @param ecdc_console Console to use
+ */
+void
+ecdc_end_batch(struct ecdc_console * console);
+
+
 /**
  * @brief Replaces the command prompt
  * @details This will set the prompt or replaces it if was previously set
@@ -160,6 +717,30 @@ ecdc_replace_prompt(struct ecdc_console * console,
                     char const * prompt);
 
 
+/**
+ * @brief Allocates an output staging buffer for the console
+ * @details Console output is normally written to puts_fn as it is generated.
+ *          With an output buffer, all writes made during a pump (including
+ *          local echo, prompts, and command output) are combined and written
+ *          out with a single puts_fn call at the end of the pump, or earlier
+ *          if the buffer fills up. Output written outside of a pump is
+ *          flushed before ecdc_putc or ecdc_puts return.
+ *          Calling this again will flush and replace the previous buffer.
+ *          For a console from ecdc_init_console, the buffer is carved out of
+ *          the console's storage, and replaced buffers are not reclaimed
+ *
+ * @param ecdc_console Console to modify
+ * @param size Size of the output buffer. Set to 0 to remove the buffer and
+ *          write output directly to puts_fn
+ *
+ * @return 0 on success, -1 if the buffer could not be allocated. On failure
+ *          the console will write output directly to puts_fn
+ */
+int
+ecdc_alloc_output_buffer(struct ecdc_console * console,
+                         size_t size);
+
+
 // ------------------------------------------ Command allocation / deallocation
 
 
@@ -178,8 +759,66 @@ struct ecdc_command;
 typedef void (*ecdc_callback_fn)(void * hint, int argc, char const * argv[]);
 
 
+// ----- ecdc_resumable_fn return values
+#define ECDC_DONE               0
+#define ECDC_CONTINUE           1
+
+
+/**
+ * @brief Function pointer prototype for resumable command callbacks
+ * @details A resumable command does a slice of its work each time it is
+ *          called, and returns ECDC_CONTINUE until it is finished. It is first
+ *          called in the pump that read the command, and then once per pump.
+ *          Input is not processed and the prompt is not shown until the
+ *          command returns ECDC_DONE, and argv stays valid until then
+ *
+ * @param hint Optional command hint parameter
+ * @param state Saved state. This points to NULL on the first call, and
+ *          whatever the command stores here is kept between calls
+ * @param argc Argument count
+ * @param argv Argument values. First argument is always the command name
+ *
+ * @return ECDC_CONTINUE to be called again on the next pump, or ECDC_DONE
+ */
+typedef int (*ecdc_resumable_fn)(void * hint,
+                                 void ** state,
+                                 int argc,
+                                 char const * argv[]);
+
+
+/**
+ * @brief Allocates a fixed size pool of commands for the console
+ * @details Once the pool exists, ecdc_alloc_command takes commands from it
+ *          without allocating, and ecdc_free_command returns them, so commands
+ *          can be registered and freed at runtime without fragmenting the heap.
+ *          If the pool is empty or a name is too long for it, commands are
+ *          allocated from the heap, unless the console came from
+ *          ecdc_init_console, in which case the pool is allocated from the
+ *          console's storage and allocation fails instead.
+ *          Like any command, commands from the pool can be freed before or
+ *          after the console. A heap pool is kept until the last of its
+ *          commands is freed. The pool can only be allocated once
+ *
+ * @param ecdc_console Console to allocate the pool for
+ * @param command_count Number of commands in the pool
+ * @param max_name_length Longest command name the pool can hold, not
+ *          including the '\0'
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+ecdc_alloc_command_pool(struct ecdc_console * console,
+                        size_t command_count,
+                        size_t max_name_length);
+
+
 /**
  * @brief Allocates a new command on the heap
+ * @details If the console has a command pool, the command is taken from the
+ *          pool instead. See ecdc_alloc_command_pool.
+ *          Registering inserts the command into an index sorted by name, which
+ *          moves the entries after it, so it takes time linear in the number
+ *          of registered commands
  *
  * @param command_hint Optional command hint parameter. This will be passed to
  *          the command callback. This pointer may be used for whatever the
@@ -202,9 +841,35 @@ ecdc_alloc_command(void * command_hint,
                    ecdc_callback_fn callback);
 
 
+/**
+ * @brief Allocates a new resumable command
+ * @details This is the same as ecdc_alloc_command, for a command that runs
+ *          across several pumps. See ecdc_resumable_fn.
+ *          ecdc_feed returns early when a resumable command yields, see
+ *          ecdc_feed
+ *
+ * @param command_hint Optional command hint parameter
+ * @param ecdc_console Console to register the command with
+ * @param command_name Name of the command. This string is copied
+ * @param callback Resumable command callback
+ *
+ * @return Command structure, to be deallocated with ecdc_free_command. If the
+ *          command is freed while it is running, it is not called again. NULL
+ *          is returned on failure.
+ */
+struct ecdc_command *
+ecdc_alloc_resumable_command(void * command_hint,
+                             struct ecdc_console * console,
+                             const char * command_name,
+                             ecdc_resumable_fn callback);
+
+
 /**
  * @brief Deallocates a command structure
- * @details This will unregister the command and free any resources held by it
+ * @details This will unregister the command and free any resources held by it.
+ *          Unlinking the command takes constant time, but removing it from the
+ *          name index moves the entries after it, which is linear in the
+ *          number of registered commands
  *
  * @param ecdc_command Command to deallocate
  */
@@ -212,6 +877,465 @@ void
 ecdc_free_command(struct ecdc_command * command);
 
 
+/**
+ * @brief Assigns a command to a group
+ * @details Groups allow a set of commands (such as all commands of a module)
+ *          to be unregistered and freed together with ecdc_free_command_group.
+ *          Commands start out in group 0
+ *
+ * @param ecdc_command Command to modify
+ * @param group Group identifier
+ */
+void
+ecdc_set_command_group(struct ecdc_command * command,
+                       int group);
+
+
+/**
+ * @brief Unregisters and deallocates every command in a group
+ * @details This is the same as calling ecdc_free_command on each command in
+ *          the group, but it takes a single pass over the registered commands
+ *          and a single compaction of the name index
+ *
+ * @param ecdc_console Console to remove the commands from
+ * @param group Group identifier
+ */
+void
+ecdc_free_command_group(struct ecdc_console * console,
+                        int group);
+
+
+/**
+ * @brief Initializes a command in caller provided storage
+ * @details This is the same as ecdc_alloc_command, except that the command and
+ *          a copy of its name are placed in storage instead of the heap. The
+ *          command should still be released with ecdc_free_command, after
+ *          which the storage may be reused
+ *
+ * @param storage Storage for the command. This does not need to be aligned
+ * @param storage_size Size of storage. ECDC_COMMAND_STORAGE_SIZE will compute
+ *          the size needed for a command name
+ * @param command_hint Optional command hint parameter
+ * @param ecdc_console Console to register the command with
+ * @param command_name Name of the command
+ * @param callback Command callback
+ *
+ * @return Command structure, or NULL on failure
+ */
+struct ecdc_command *
+ecdc_init_command(void * storage,
+                  size_t storage_size,
+                  void * command_hint,
+                  struct ecdc_console * console,
+                  const char * command_name,
+                  ecdc_callback_fn callback);
+
+
+/**
+ * @brief Initializes a resumable command in caller provided storage
+ * @details This is the same as ecdc_alloc_resumable_command, with the
+ *          storage handled like ecdc_init_command
+ *
+ * @param storage Storage for the command. This does not need to be aligned
+ * @param storage_size Size of storage, see ECDC_COMMAND_STORAGE_SIZE
+ * @param command_hint Optional command hint parameter
+ * @param ecdc_console Console to register the command with
+ * @param command_name Name of the command
+ * @param callback Resumable command callback
+ *
+ * @return Command structure, or NULL on failure
+ */
+struct ecdc_command *
+ecdc_init_resumable_command(void * storage,
+                            size_t storage_size,
+                            void * command_hint,
+                            struct ecdc_console * console,
+                            const char * command_name,
+                            ecdc_resumable_fn callback);
+
+
+// ------------------------------------------------------------ Static commands
+
+// Static commands are supported on GCC compatible compilers that output ELF
+// objects. Define ECDC_ENABLE_STATIC_COMMANDS to 0 to disable them
+#ifndef ECDC_ENABLE_STATIC_COMMANDS
+#  if defined(__GNUC__) && defined(__ELF__)
+#    define ECDC_ENABLE_STATIC_COMMANDS 1
+#  else
+#    define ECDC_ENABLE_STATIC_COMMANDS 0
+#  endif
+#endif
+
+
+// ---------- Static command descriptor
+struct ecdc_static_command {
+    const char *                        name;
+    size_t                              name_length;
+    ecdc_callback_fn                    callback;
+    void *                              hint;
+};
+
+
+#if ECDC_ENABLE_STATIC_COMMANDS
+
+#define ECDC_STATIC_COMMAND_CAT_(a, b)  a ## b
+#define ECDC_STATIC_COMMAND_CAT(a, b)   ECDC_STATIC_COMMAND_CAT_(a, b)
+
+/**
+ * @brief Registers a command at link time
+ * @details The command descriptor is const and placed in the ecdc_commands
+ *          linker section, so it lives in flash and costs nothing at boot.
+ *          Static commands are available on every console, and are looked
+ *          up after the commands registered with ecdc_alloc_command.
+ *          This should be used at file scope, at most once per line.
+ *          When using a custom linker script, the section needs to be kept
+ *          and bracketed with start and stop symbols, i.e.
+ *              __start_ecdc_commands = .;
+ *              KEEP(*(ecdc_commands))
+ *              __stop_ecdc_commands = .;
+ *
+ * @param command_name String literal name of the command
+ * @param command_callback Command callback
+ * @param command_hint Hint passed to the command callback
+ */
+#define ECDC_COMMAND(command_name, command_callback, command_hint)            \
+    static const struct ecdc_static_command                                   \
+    ECDC_STATIC_COMMAND_CAT(ecdc_static_command_, __LINE__)                   \
+    __attribute__((section("ecdc_commands"), used, aligned(sizeof(void *))))  \
+    = {                                                                       \
+        command_name,                                                         \
+        sizeof(command_name) - 1,                                             \
+        command_callback,                                                     \
+        command_hint                                                          \
+    }
+
+#endif /* ECDC_ENABLE_STATIC_COMMANDS */
+
+
+// ------------------------------------------------------------ Shared registry
+
+// The shared registry needs atomics, and is enabled when C11 atomics or the
+// GCC atomic builtins are available. Define ECDC_ENABLE_REGISTRY to 0 to
+// disable it
+#ifndef ECDC_ENABLE_REGISTRY
+#  if (defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)             \
+        && !defined(__STDC_NO_ATOMICS__)) || defined(__GNUC__)
+#    define ECDC_ENABLE_REGISTRY 1
+#  else
+#    define ECDC_ENABLE_REGISTRY 0
+#  endif
+#endif
+
+
+#if ECDC_ENABLE_REGISTRY
+
+// --------- Internal registry structure
+struct ecdc_registry;
+
+
+/**
+ * @brief Allocates a command registry that can be shared between consoles
+ * @details A registry holds commands that are available to every console
+ *          attached to it, and may be used from several threads. Dispatch
+ *          never takes a lock; it reads an immutable snapshot of the
+ *          registry. Adding or removing a command builds and swaps in a new
+ *          snapshot, and old snapshots are freed once no console is using
+ *          them. Writers are serialized with a spin lock.
+ *          Registries always use the heap
+ *
+ * @param max_readers Maximum number of consoles that can be attached
+ *
+ * @return Registry pointer. It is the responsibility of the caller to
+ *          deallocate this with ecdc_free_registry, after every console has
+ *          been detached. NULL is returned on failure.
+ */
+struct ecdc_registry *
+ecdc_alloc_registry(size_t max_readers);
+
+
+/**
+ * @brief Deallocates a registry
+ *
+ * @param registry Registry to deallocate
+ */
+void
+ecdc_free_registry(struct ecdc_registry * registry);
+
+
+/**
+ * @brief Adds a command to a registry
+ * @details This is safe to call from any thread, including from a command
+ *          callback. Commands are listed in name order by the list command
+ *
+ * @param registry Registry to add the command to
+ * @param command_name Name of the command. This string is copied
+ * @param callback Command callback. This may be called from any thread with
+ *          an attached console
+ * @param command_hint Hint passed to the command callback
+ *
+ * @return 0 on success, -1 if the name is taken or on failure
+ */
+int
+ecdc_registry_add(struct ecdc_registry * registry,
+                  const char * command_name,
+                  ecdc_callback_fn callback,
+                  void * command_hint);
+
+
+/**
+ * @brief Removes a command from a registry
+ * @details This is safe to call from any thread. A console that is already
+ *          running the command will finish it
+ *
+ * @param registry Registry to remove the command from
+ * @param command_name Name of the command
+ *
+ * @return 0 on success, -1 if the command was not found or on failure
+ */
+int
+ecdc_registry_remove(struct ecdc_registry * registry,
+                     const char * command_name);
+
+
+/**
+ * @brief Attaches a console to a registry
+ * @details Registry commands are looked up after the console's own commands,
+ *          and before static commands. A console can be attached to one
+ *          registry at a time. The console is detached when it is freed
+ *
+ * @param ecdc_console Console to attach
+ * @param registry Registry to attach to
+ *
+ * @return 0 on success, -1 if the registry has no free reader slots
+ */
+int
+ecdc_attach_registry(struct ecdc_console * console,
+                     struct ecdc_registry * registry);
+
+
+/**
+ * @brief Detaches a console from its registry
+ * @details This must not be called while the console is being pumped
+ *
+ * @param ecdc_console Console to detach
+ */
+void
+ecdc_detach_registry(struct ecdc_console * console);
+
+#endif /* ECDC_ENABLE_REGISTRY */
+
+
+// ----------------------------------------------------------------- Statistics
+
+#if ECDC_ENABLE_STATS
+
+// Counters kept by each console. They wrap around when they overflow
+struct ecdc_stats {
+    // Input characters received from the transport or fed in
+    unsigned long                       bytes_received;
+
+    // Output written to the transport, and the calls it took
+    unsigned long                       bytes_sent;
+    unsigned long                       send_calls;
+
+    // Lines looked up, and lines whose command wasn't found
+    unsigned long                       lines_dispatched;
+    unsigned long                       unknown_commands;
+
+    // Input characters dropped because the argument line was full
+    unsigned long                       overflow_drops;
+
+    // Escape sequences that were cancelled or too long
+    unsigned long                       escape_aborts;
+
+    // Longest ecdc_pump_console call, in clock ticks
+    unsigned long                       max_pump_ticks;
+};
+
+
+/**
+ * @brief Sets the clock used to time pumps
+ * @details Pumps are not timed until a clock is set
+ *
+ * @param ecdc_console Console to time
+ * @param clock_fn Clock, or NULL to stop timing
+ */
+void
+ecdc_set_stats_clock(struct ecdc_console * console,
+                     ecdc_clock_fn clock_fn);
+
+
+/**
+ * @brief Copies the console's statistics counters
+ *
+ * @param ecdc_console Console to read
+ * @param stats Where to copy the counters to
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+ecdc_get_stats(struct ecdc_console * console,
+               struct ecdc_stats * stats);
+
+
+/**
+ * @brief Sets all of the console's statistics counters to 0
+ *
+ * @param ecdc_console Console to reset
+ */
+void
+ecdc_reset_stats(struct ecdc_console * console);
+
+#endif /* ECDC_ENABLE_STATS */
+
+
+// ------------------------------------------------------------------- Profiler
+
+#if ECDC_ENABLE_PROFILER
+
+// Execution profile of a console command. Each step of a resumable command
+// counts as a call
+struct ecdc_profile {
+    unsigned long                       calls;
+    unsigned long long                  total_cycles;
+    unsigned long                       max_cycles;
+
+    // Bucket i counts calls shorter than 2^(ECDC_PROFILE_MIN_LOG2 + i + 1)
+    // cycles that didn't fit in bucket i - 1. The last bucket also counts
+    // everything longer
+    unsigned long                       histogram[ECDC_PROFILE_BUCKETS];
+};
+
+
+/**
+ * @brief Sets the cycle counter that commands are timed with
+ * @details Commands are not profiled until a clock is set. Only console
+ *          commands are profiled, not shared registry or static commands
+ *
+ * @param ecdc_console Console to profile
+ * @param clock_fn Cycle counter, or NULL to stop profiling
+ */
+void
+ecdc_set_profile_clock(struct ecdc_console * console,
+                       ecdc_clock_fn clock_fn);
+
+
+/**
+ * @brief Copies a command's execution profile
+ *
+ * @param command Command to read
+ * @param profile Where to copy the profile to
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+ecdc_get_profile(struct ecdc_command * command,
+                 struct ecdc_profile * profile);
+
+
+/**
+ * @brief Clears the execution profiles of all of the console's commands
+ *
+ * @param ecdc_console Console to reset
+ */
+void
+ecdc_reset_profiles(struct ecdc_console * console);
+
+#endif /* ECDC_ENABLE_PROFILER */
+
+
+// ---------------------------------------------------------------------- Trace
+
+#if ECDC_ENABLE_TRACE
+
+// ----------------- Trace event codes
+enum ecdc_trace_event {
+    // Input character received. The payload is the character
+    ECDC_TRACE_INPUT            = 0,
+
+    // Escape sequence that was cancelled or too long. The payload is the
+    // length of the sequence that was dropped
+    ECDC_TRACE_ESCAPE_ABORT     = 1,
+
+    // Command line looked up. The payload is its argument count
+    ECDC_TRACE_DISPATCH         = 2,
+
+    // Command line whose command wasn't found. The payload is its argument
+    // count
+    ECDC_TRACE_UNKNOWN_COMMAND  = 3,
+
+    // Input character dropped because the argument line was full. The
+    // payload is the character
+    ECDC_TRACE_OVERFLOW         = 4
+};
+
+
+// One recorded event
+struct ecdc_trace_entry {
+    // Reading of the trace clock, or 0 without one
+    unsigned long                       timestamp;
+
+    // Address of the console's state function when the event happened, to
+    // be looked up in the map file
+    void                                (*state)(void);
+
+    // ecdc_trace_event, and its payload
+    unsigned short                      event;
+    unsigned short                      payload;
+};
+
+
+/**
+ * @brief Allocates an event trace for the console
+ * @details Once allocated, the console records its events in a ring of
+ *          entries, overwriting the oldest. Without a trace, recording an
+ *          event costs a single check.
+ *          For a console from ecdc_init_console, the trace is carved out of
+ *          the console's storage. The trace can only be allocated once
+ *
+ * @param ecdc_console Console to trace
+ * @param entries Number of entries in the ring. This must be a power of two
+ *
+ * @return 0 on success, -1 on failure
+ */
+int
+ecdc_alloc_trace(struct ecdc_console * console,
+                 size_t entries);
+
+
+/**
+ * @brief Sets the clock that trace entries are stamped with
+ *
+ * @param ecdc_console Console to trace
+ * @param clock_fn Clock, or NULL to stamp entries with 0
+ */
+void
+ecdc_set_trace_clock(struct ecdc_console * console,
+                     ecdc_clock_fn clock_fn);
+
+
+/**
+ * @brief Copies the most recent trace entries, oldest first
+ * @details This takes no locks and doesn't modify the console, so it can be
+ *          called from a fault or crash handler that interrupted the
+ *          console, or on a halted target. The entry that may have been
+ *          half written when the console was interrupted is left out, so at
+ *          most entries - 1 are available
+ *
+ * @param ecdc_console Console to read
+ * @param entries Where to copy the entries to
+ * @param max_entries Maximum number of entries to copy
+ *
+ * @return Number of entries copied
+ */
+size_t
+ecdc_read_trace(const struct ecdc_console * console,
+                struct ecdc_trace_entry * entries,
+                size_t max_entries);
+
+#endif /* ECDC_ENABLE_TRACE */
+
+
 // ------------------------------------------------- Built-in optional commands
 
 
@@ -230,6 +1354,125 @@ struct ecdc_command *
 ecdc_alloc_list_command(struct ecdc_console * console,
                         const char * command_name);
 
+
+/**
+ * @brief Initializes a list command in caller provided storage
+ * @details See ecdc_alloc_list_command and ecdc_init_command
+ *
+ * @return Command structure, or NULL on failure
+ */
+struct ecdc_command *
+ecdc_init_list_command(void * storage,
+                       size_t storage_size,
+                       struct ecdc_console * console,
+                       const char * command_name);
+
+
+#if ECDC_ENABLE_STATS
+
+/**
+ * @brief Creates a statistics command
+ * @details This command prints the console's statistics counters, one per
+ *          line. Run with the argument "reset", it sets them to 0
+ *
+ * @param ecdc_console Console to register the command with
+ * @param command_name Name of the command, i.e. "stats"
+ *
+ * @return Command structure. It is the responsibility of the caller to
+ *          deallocate this with the ecdc_free_command function. NULL is
+ *          returned on failure.
+ */
+struct ecdc_command *
+ecdc_alloc_stats_command(struct ecdc_console * console,
+                         const char * command_name);
+
+
+/**
+ * @brief Initializes a statistics command in caller provided storage
+ * @details See ecdc_alloc_stats_command and ecdc_init_command
+ *
+ * @return Command structure, or NULL on failure
+ */
+struct ecdc_command *
+ecdc_init_stats_command(void * storage,
+                        size_t storage_size,
+                        struct ecdc_console * console,
+                        const char * command_name);
+
+#endif /* ECDC_ENABLE_STATS */
+
+
+#if ECDC_ENABLE_PROFILER
+
+/**
+ * @brief Creates a profiler command
+ * @details This command prints the execution profile of every console
+ *          command that has been called, one per line: name, calls, total
+ *          and maximum cycles, then the non-empty histogram buckets as
+ *          log2:count, where log2 is the bucket's upper bound. Run with the
+ *          argument "reset", it clears the profiles
+ *
+ * @param ecdc_console Console to register the command with
+ * @param command_name Name of the command, i.e. "prof"
+ *
+ * @return Command structure. It is the responsibility of the caller to
+ *          deallocate this with the ecdc_free_command function. NULL is
+ *          returned on failure.
+ */
+struct ecdc_command *
+ecdc_alloc_profile_command(struct ecdc_console * console,
+                           const char * command_name);
+
+
+/**
+ * @brief Initializes a profiler command in caller provided storage
+ * @details See ecdc_alloc_profile_command and ecdc_init_command
+ *
+ * @return Command structure, or NULL on failure
+ */
+struct ecdc_command *
+ecdc_init_profile_command(void * storage,
+                          size_t storage_size,
+                          struct ecdc_console * console,
+                          const char * command_name);
+
+#endif /* ECDC_ENABLE_PROFILER */
+
+
+#if ECDC_ENABLE_TRACE
+
+/**
+ * @brief Creates a trace dump command
+ * @details This command prints the console's trace entries, oldest first,
+ *          one per line: timestamp, state function address, event, and
+ *          payload
+ *
+ * @param ecdc_console Console to register the command with
+ * @param command_name Name of the command, i.e. "trace"
+ *
+ * @return Command structure. It is the responsibility of the caller to
+ *          deallocate this with the ecdc_free_command function. NULL is
+ *          returned on failure.
+ */
+struct ecdc_command *
+ecdc_alloc_trace_command(struct ecdc_console * console,
+                         const char * command_name);
+
+
+/**
+ * @brief Initializes a trace dump command in caller provided storage
+ * @details See ecdc_alloc_trace_command and ecdc_init_command
+ *
+ * @return Command structure, or NULL on failure
+ */
+struct ecdc_command *
+ecdc_init_trace_command(void * storage,
+                        size_t storage_size,
+                        struct ecdc_console * console,
+                        const char * command_name);
+
+#endif /* ECDC_ENABLE_TRACE */
+
 // --------------------------------------------------------------------- Extras
 
 
@@ -255,6 +1498,103 @@ void
 ecdc_puts(struct ecdc_console * console, const char * str);
 
 
+// Floating point support in ecdc_printf. Define ECDC_ENABLE_PRINTF_FLOAT to 0
+// to leave out %f, and with it any floating point code
+#ifndef ECDC_ENABLE_PRINTF_FLOAT
+#  define ECDC_ENABLE_PRINTF_FLOAT 1
+#endif
+
+#if defined(__GNUC__)
+#  define ECDC_PRINTF_FORMAT(format_index, first_arg)                         \
+    __attribute__((format(printf, format_index, first_arg)))
+#else
+#  define ECDC_PRINTF_FORMAT(format_index, first_arg)
+#endif
+
+
+/**
+ * @brief Writes formatted output to the console
+ * @details This is a small formatter that writes straight into the console
+ *          output, without stdio. It supports the flags - 0 # + and space,
+ *          width and precision (including *), the h, l, ll, j, z and t
+ *          lengths, and the conversions d i u o x X p c s %, plus f for
+ *          magnitudes below 2^64 when ECDC_ENABLE_PRINTF_FLOAT is set
+ *          (precision is capped at 9). Other conversions take their argument
+ *          and are written out as they appear in the format.
+ *          Newlines are translated as with ecdc_puts
+ *
+ * @param ecdc_console Console output to use
+ * @param format printf style format string
+ *
+ * @return Number of characters formatted, before newline translation, or -1
+ *          on failure
+ */
+int
+ecdc_printf(struct ecdc_console * console,
+            const char * format,
+            ...) ECDC_PRINTF_FORMAT(2, 3);
+
+
+/**
+ * @brief Writes formatted output to the console, see ecdc_printf
+ *
+ * @param ecdc_console Console output to use
+ * @param format printf style format string
+ * @param args Format arguments
+ *
+ * @return Number of characters formatted, or -1 on failure
+ */
+int
+ecdc_vprintf(struct ecdc_console * console,
+             const char * format,
+             va_list args) ECDC_PRINTF_FORMAT(2, 0);
+
+
+/**
+ * @brief Reserves space in the output buffer for a command to write into
+ * @details This lets a command format output directly in the console's
+ *          output buffer (see ecdc_alloc_output_buffer), instead of in its own
+ *          buffer that ecdc_puts then copies. Write up to size characters at
+ *          the returned pointer, then call ecdc_out_commit. Nothing else may
+ *          be written to the console in between. The output does not need to
+ *          be terminated
+ *
+ * @param ecdc_console Console to write to
+ * @param size Number of characters to reserve
+ *
+ * @return Pointer into the output buffer, or NULL if the console has no
+ *          output buffer or size is larger than it
+ */
+char *
+ecdc_out_reserve(struct ecdc_console * console,
+                 size_t size);
+
+
+/**
+ * @brief Commits output written into space from ecdc_out_reserve
+ * @details Newlines and backspaces are translated as with ecdc_puts. This is
+ *          done in place when the buffer has room for it
+ *
+ * @param ecdc_console Console to write to
+ * @param used Number of characters written, up to the size reserved
+ */
+void
+ecdc_out_commit(struct ecdc_console * console,
+                size_t used);
+
+
+/**
+ * @brief Writes any buffered output to the console
+ * @details This is only needed when the console has an output buffer, and a
+ *          command needs its output to go out before it returns (such as
+ *          before a long running operation)
+ *
+ * @param ecdc_console Console output to flush
+ */
+void
+ecdc_flush(struct ecdc_console * console);
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
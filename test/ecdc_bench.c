@@ -0,0 +1,337 @@
+// clock_gettime, this is built as plain C99 and C11
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+
+#include "ecdc/ecdc.h"
+
+
+// ------------------------------------------------------------------- Settings
+
+#define COMMAND_REPEAT          20000
+#define OUTPUT_BUFFER_SIZE      256
+#define READ_BUFFER_SIZE        64
+#define MAX_ARGC                16
+
+// Registered command counts for the dispatch latency runs
+static const size_t COMMAND_COUNTS[] = { 10, 100, 1000, 10000 };
+
+// Line lengths for the tokenizer runs
+static const size_t LINE_LENGTHS[] = { 16, 64, 256, 1024, 4096 };
+
+
+// ------------------------------------------------------------------- Helpers
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+// Results are written one per line as benchmark,parameter,value,unit
+static void
+report(const char * benchmark, const char * parameter, double value,
+       const char * unit)
+{
+    fprintf(stdout, "%s,%s,%.6g,%s\n", benchmark, parameter, value, unit);
+}
+
+
+// --------------------------------------------------------- Memory transport
+
+// Input comes from a buffer, output is counted and thrown away
+struct transport {
+    const char *                input;
+    size_t                      input_len;
+    size_t                      input_index;
+
+    size_t                      puts_calls;
+    size_t                      puts_bytes;
+};
+
+static void
+transport_reset(struct transport * transport, const char * input, size_t len)
+{
+    transport->input = input;
+    transport->input_len = len;
+    transport->input_index = 0;
+    transport->puts_calls = 0;
+    transport->puts_bytes = 0;
+}
+
+static bool
+transport_done(const struct transport * transport)
+{
+    return transport->input_index >= transport->input_len;
+}
+
+static int
+transport_getc(void * hint)
+{
+    struct transport * transport = (struct transport *) hint;
+    if(transport_done(transport)) {
+        return ECDC_GETC_EOF;
+    }
+    return (unsigned char) transport->input[transport->input_index++];
+}
+
+static size_t
+transport_read(void * hint, char * buf, size_t max)
+{
+    struct transport * transport = (struct transport *) hint;
+    size_t len = transport->input_len - transport->input_index;
+    if(len > max) {
+        len = max;
+    }
+    memcpy(buf, &transport->input[transport->input_index], len);
+    transport->input_index += len;
+    return len;
+}
+
+static void
+transport_puts(void * hint, const char * s, size_t len)
+{
+    (void) s;
+
+    struct transport * transport = (struct transport *) hint;
+    ++transport->puts_calls;
+    transport->puts_bytes += len;
+}
+
+static void
+count_command(void * hint, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    size_t * count = (size_t *) hint;
+    ++(*count);
+}
+
+// Repeats line count times into a new buffer
+static char *
+make_input(const char * line, size_t count, size_t * len)
+{
+    size_t line_len = strlen(line);
+    char * input = (char *) malloc(line_len * count);
+
+    size_t i;
+    for(i = 0; i < count; ++i) {
+        memcpy(&input[i * line_len], line, line_len);
+    }
+
+    *len = line_len * count;
+    return input;
+}
+
+
+// ------------------------------------------------------------ Pump benchmarks
+
+struct pump_config {
+    const char *                name;
+    bool                        f_bulk_read;
+    bool                        f_output_buffer;
+    bool                        f_local_echo;
+};
+
+static const struct pump_config PUMP_CONFIGS[] = {
+    { "getc",               false,  false,  true },
+    { "getc_buffered",      false,  true,   true },
+    { "read",               true,   false,  true },
+    { "read_buffered",      true,   true,   true },
+    { "read_buffered_quiet", true,  true,   false },
+};
+
+// Runs the same command stream through ecdc_pump_console, and reports the
+// throughput, and the pumps and puts calls it took per command
+static void
+bench_pump(const struct pump_config * config)
+{
+    static const char LINE[] = "led 1 on\r";
+
+    struct transport transport;
+    size_t command_count = 0;
+
+    struct ecdc_console * console = config->f_bulk_read
+        ? ecdc_alloc_console_bulk(&transport, transport_read, transport_puts,
+                                  80, MAX_ARGC, READ_BUFFER_SIZE)
+        : ecdc_alloc_console(&transport, transport_getc, transport_puts,
+                             80, MAX_ARGC);
+    struct ecdc_command * command =
+        ecdc_alloc_command(&command_count, console, "led", count_command);
+    if(config->f_output_buffer) {
+        (void) ecdc_alloc_output_buffer(console, OUTPUT_BUFFER_SIZE);
+    }
+    ecdc_configure_console(console, ECDC_MODE_ANSI,
+                           config->f_local_echo ? ECDC_SET_LOCAL_ECHO : 0);
+
+    size_t input_len;
+    char * input = make_input(LINE, COMMAND_REPEAT, &input_len);
+    transport_reset(&transport, input, input_len);
+
+    size_t pump_count = 0;
+    uint64_t start = now_ns();
+    while(!transport_done(&transport)) {
+        ecdc_pump_console(console);
+        ++pump_count;
+    }
+    // The last command runs once its end of line has been read
+    ecdc_pump_console(console);
+    ++pump_count;
+    uint64_t elapsed = now_ns() - start;
+
+    report("pump_bytes_per_sec", config->name,
+           ((double) input_len * 1e9) / (double) elapsed, "bytes/s");
+    report("pumps_per_command", config->name,
+           (double) pump_count / (double) command_count, "pumps");
+    report("puts_calls_per_command", config->name,
+           (double) transport.puts_calls / (double) command_count, "calls");
+    report("puts_bytes_per_command", config->name,
+           (double) transport.puts_bytes / (double) command_count, "bytes");
+
+    free(input);
+    ecdc_free_command(command);
+    ecdc_free_console(console);
+}
+
+
+// -------------------------------------------------------- Dispatch benchmarks
+
+// Times a command line from its first character to its callback, with
+// command_count commands registered
+static void
+bench_dispatch(size_t command_count)
+{
+    struct transport transport;
+    size_t call_count = 0;
+
+    transport_reset(&transport, NULL, 0);
+    struct ecdc_console * console =
+        ecdc_alloc_console(&transport, NULL, transport_puts, 80, MAX_ARGC);
+    ecdc_configure_console(console, ECDC_MODE_ANSI, 0);
+    (void) ecdc_alloc_output_buffer(console, OUTPUT_BUFFER_SIZE);
+
+    struct ecdc_command ** commands = (struct ecdc_command **)
+        malloc(command_count * sizeof(struct ecdc_command *));
+    char name[16];
+    size_t i;
+    for(i = 0; i < command_count; ++i) {
+        snprintf(name, sizeof(name), "cmd_%05u", (unsigned int) i);
+        commands[i] = ecdc_alloc_command(&call_count, console, name,
+                                         count_command);
+    }
+
+    // Every command gets called, in a scattered order
+    char * lines = (char *) malloc(COMMAND_REPEAT * 16);
+    size_t lines_len = 0;
+    for(i = 0; i < COMMAND_REPEAT; ++i) {
+        size_t index = (i * 7919) % command_count;
+        lines_len += (size_t) sprintf(&lines[lines_len], "cmd_%05u\r",
+                                      (unsigned int) index);
+    }
+
+    uint64_t start = now_ns();
+    ecdc_feed(console, lines, lines_len);
+    uint64_t elapsed = now_ns() - start;
+
+    char parameter[16];
+    snprintf(parameter, sizeof(parameter), "%u", (unsigned int) command_count);
+    report("dispatch_ns_per_command", parameter,
+           (double) elapsed / (double) call_count, "ns");
+
+    free(lines);
+    for(i = 0; i < command_count; ++i) {
+        ecdc_free_command(commands[i]);
+    }
+    free(commands);
+    ecdc_free_console(console);
+}
+
+
+// ------------------------------------------------------- Tokenizer benchmarks
+
+// Times lines of MAX_ARGC arguments of the given length, typed without echo
+static void
+bench_tokenizer(size_t line_length)
+{
+    struct transport transport;
+    size_t call_count = 0;
+
+    transport_reset(&transport, NULL, 0);
+    struct ecdc_console * console =
+        ecdc_alloc_console(&transport, NULL, transport_puts, line_length,
+                           MAX_ARGC);
+    ecdc_configure_console(console, ECDC_MODE_ANSI, 0);
+    (void) ecdc_alloc_output_buffer(console, OUTPUT_BUFFER_SIZE);
+    struct ecdc_command * command =
+        ecdc_alloc_command(&call_count, console, "t", count_command);
+
+    // "t" followed by arguments of about equal length, then the line end
+    char * line = (char *) malloc(line_length + 2);
+    size_t arg_length = line_length / MAX_ARGC;
+    line[0] = 't';
+    size_t i;
+    for(i = 1; i < line_length; ++i) {
+        bool separator = (1 == i) || (0 == (i % arg_length));
+        line[i] = separator ? ' ' : (char) ('a' + (i % 26));
+    }
+    line[line_length] = '\r';
+    line[line_length + 1] = '\0';
+
+    size_t repeat = (COMMAND_REPEAT * 64) / line_length;
+    size_t input_len;
+    char * input = make_input(line, repeat, &input_len);
+
+    uint64_t start = now_ns();
+    ecdc_feed(console, input, input_len);
+    uint64_t elapsed = now_ns() - start;
+
+    char parameter[16];
+    snprintf(parameter, sizeof(parameter), "%u", (unsigned int) line_length);
+    report("tokenize_ns_per_line", parameter,
+           (double) elapsed / (double) call_count, "ns");
+    report("tokenize_ns_per_byte", parameter,
+           (double) elapsed / (double) input_len, "ns");
+
+    free(input);
+    free(line);
+    ecdc_free_command(command);
+    ecdc_free_console(console);
+}
+
+
+// ---------------------------------------------------------------------- Main
+
+int
+main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    fprintf(stdout, "benchmark,parameter,value,unit\n");
+
+    size_t i;
+    for(i = 0; i < (sizeof(PUMP_CONFIGS) / sizeof(PUMP_CONFIGS[0])); ++i) {
+        bench_pump(&PUMP_CONFIGS[i]);
+    }
+
+    for(i = 0; i < (sizeof(COMMAND_COUNTS) / sizeof(COMMAND_COUNTS[0])); ++i) {
+        bench_dispatch(COMMAND_COUNTS[i]);
+    }
+
+    for(i = 0; i < (sizeof(LINE_LENGTHS) / sizeof(LINE_LENGTHS[0])); ++i) {
+        bench_tokenizer(LINE_LENGTHS[i]);
+    }
+
+    return 0;
+}
@@ -0,0 +1,151 @@
+// clock_gettime, this is built as plain C99 and C11
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+
+#include "ecdc/ecdc.h"
+
+
+// ------------------------------------------------------------------- Settings
+
+#define ITERATIONS              200000
+#define OUTPUT_BUFFER_SIZE      128
+
+
+// ------------------------------------------------------------------- Helpers
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+// Keeps the compiler from dropping the work
+static volatile size_t g_sink;
+
+static void
+sink_puts(void * console_hint, const char * s, size_t len)
+{
+    (void) console_hint;
+    g_sink += len + (size_t) s[0];
+}
+
+
+// ---------------------------------------------------------------- Workloads
+
+// Each workload formats the same line with ecdc_printf, and with snprintf
+// into a local buffer followed by ecdc_puts, the usual way to do it before
+typedef void (*format_fn)(struct ecdc_console * console, bool f_snprintf, int i);
+
+static void
+format_integers(struct ecdc_console * console, bool f_snprintf, int i)
+{
+    if(f_snprintf) {
+        char line[OUTPUT_BUFFER_SIZE];
+        snprintf(line, sizeof(line), "reg %d = 0x%08x (%u)\n",
+                 i & 0xFF, (unsigned int) i * 2654435761u, (unsigned int) i);
+        ecdc_puts(console, line);
+    } else {
+        ecdc_printf(console, "reg %d = 0x%08x (%u)\n",
+                    i & 0xFF, (unsigned int) i * 2654435761u, (unsigned int) i);
+    }
+}
+
+static void
+format_strings(struct ecdc_console * console, bool f_snprintf, int i)
+{
+    static const char * const NAMES[] = { "uart0", "spi1", "i2c2", "adc" };
+    const char * name = NAMES[i & 3];
+
+    if(f_snprintf) {
+        char line[OUTPUT_BUFFER_SIZE];
+        snprintf(line, sizeof(line), "%-8s %s\n", name, "ready");
+        ecdc_puts(console, line);
+    } else {
+        ecdc_printf(console, "%-8s %s\n", name, "ready");
+    }
+}
+
+#if ECDC_ENABLE_PRINTF_FLOAT
+static void
+format_fixed(struct ecdc_console * console, bool f_snprintf, int i)
+{
+    double value = (double) i * 0.125;
+
+    if(f_snprintf) {
+        char line[OUTPUT_BUFFER_SIZE];
+        snprintf(line, sizeof(line), "temp %.2f C\n", value);
+        ecdc_puts(console, line);
+    } else {
+        ecdc_printf(console, "temp %.2f C\n", value);
+    }
+}
+#endif
+
+struct workload {
+    const char *                name;
+    format_fn                   format;
+};
+
+static const struct workload WORKLOADS[] = {
+    { "integers",   format_integers },
+    { "strings",    format_strings },
+#if ECDC_ENABLE_PRINTF_FLOAT
+    { "fixed",      format_fixed },
+#endif
+};
+
+
+// ---------------------------------------------------------------------- Main
+
+static double
+run(struct ecdc_console * console, format_fn format, bool f_snprintf)
+{
+    uint64_t start = now_ns();
+
+    int i;
+    for(i = 0; i < ITERATIONS; ++i) {
+        format(console, f_snprintf, i);
+    }
+
+    return (double) (now_ns() - start) / (double) ITERATIONS;
+}
+
+int
+main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    struct ecdc_console * console =
+        ecdc_alloc_console(NULL, NULL, sink_puts, 80, 4);
+    if((NULL == console)
+        || (0 != ecdc_alloc_output_buffer(console, OUTPUT_BUFFER_SIZE))) {
+        fprintf(stderr, "Failed to allocate console\n");
+        return 1;
+    }
+    ecdc_configure_console(console, ECDC_MODE_ANSI, 0);
+
+    fprintf(stdout, "workload,snprintf_ns,ecdc_printf_ns\n");
+
+    size_t i;
+    for(i = 0; i < (sizeof(WORKLOADS) / sizeof(WORKLOADS[0])); ++i) {
+        double snprintf_ns = run(console, WORKLOADS[i].format, true);
+        double printf_ns = run(console, WORKLOADS[i].format, false);
+        fprintf(stdout, "%s,%.1f,%.1f\n",
+                WORKLOADS[i].name, snprintf_ns, printf_ns);
+    }
+
+    ecdc_free_console(console);
+    return 0;
+}
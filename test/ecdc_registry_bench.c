@@ -0,0 +1,195 @@
+// pthreads and clock_gettime, this is built as plain C11
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// pthread_create, pthread_join
+#include <pthread.h>
+
+// clock_gettime
+#include <time.h>
+
+#include <stdatomic.h>
+
+#include "ecdc/ecdc.h"
+
+
+// ------------------------------------------------------------------- Settings
+
+#define COMMAND_COUNT           64
+#define MAX_THREADS             8
+#define RUN_TIME_MS             500
+
+
+// ---------------------------------------------------------------------- State
+
+struct reader {
+    pthread_t                   thread;
+    int                         index;
+    struct ecdc_console *       console;
+    uint64_t                    dispatch_count;
+
+    // Keep readers from sharing a cache line
+    char                        pad[64];
+};
+
+static atomic_bool g_run;
+static struct ecdc_registry * g_registry;
+
+
+// ------------------------------------------------------------------- Helpers
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+static void
+null_puts(void * console_hint, const char * s, size_t len)
+{
+    (void) console_hint;
+    (void) s;
+    (void) len;
+}
+
+static void
+count_cmd(void * hint, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    uint64_t * count = (uint64_t *) hint;
+    ++(*count);
+}
+
+
+// ------------------------------------------------------------------- Threads
+
+static void *
+reader_thread(void * arg)
+{
+    struct reader * reader = (struct reader *) arg;
+
+    // Pre-build the input so the loop only measures the pump and dispatch
+    char line[32];
+    int len = snprintf(line, sizeof(line), "\rcmd_%d\r", reader->index);
+
+    while(atomic_load_explicit(&g_run, memory_order_relaxed)) {
+        ecdc_feed(reader->console, line, (size_t) len);
+    }
+
+    return NULL;
+}
+
+static void *
+writer_thread(void * arg)
+{
+    uint64_t * churn_count = (uint64_t *) arg;
+
+    // Keep adding and removing a command so readers see snapshot swaps
+    while(atomic_load_explicit(&g_run, memory_order_relaxed)) {
+        ecdc_registry_add(g_registry, "churn", count_cmd, churn_count);
+        ecdc_registry_remove(g_registry, "churn");
+        ++(*churn_count);
+    }
+
+    return NULL;
+}
+
+
+// ---------------------------------------------------------------------- Main
+
+static double
+run(size_t thread_count, uint64_t * churn_count)
+{
+    struct reader readers[MAX_THREADS];
+    pthread_t writer;
+
+    size_t i;
+    for(i = 0; i < thread_count; ++i) {
+        readers[i].index = (int) i;
+        readers[i].dispatch_count = 0;
+        readers[i].console = ecdc_alloc_console(NULL, NULL, null_puts, 80, 4);
+        ecdc_configure_console(readers[i].console, ECDC_MODE_ANSI, 0);
+        ecdc_attach_registry(readers[i].console, g_registry);
+    }
+
+    // Each reader counts into its own slot, through the command hint
+    char name[16];
+    for(i = 0; i < COMMAND_COUNT; ++i) {
+        snprintf(name, sizeof(name), "cmd_%d", (int) i);
+        ecdc_registry_remove(g_registry, name);
+    }
+    for(i = 0; i < thread_count; ++i) {
+        snprintf(name, sizeof(name), "cmd_%d", (int) i);
+        ecdc_registry_add(g_registry, name, count_cmd,
+                          &readers[i].dispatch_count);
+    }
+    for(i = thread_count; i < COMMAND_COUNT; ++i) {
+        snprintf(name, sizeof(name), "cmd_%d", (int) i);
+        ecdc_registry_add(g_registry, name, count_cmd, NULL);
+    }
+
+    atomic_store(&g_run, true);
+    uint64_t start = now_ns();
+
+    *churn_count = 0;
+    pthread_create(&writer, NULL, writer_thread, churn_count);
+    for(i = 0; i < thread_count; ++i) {
+        pthread_create(&readers[i].thread, NULL, reader_thread, &readers[i]);
+    }
+
+    struct timespec sleep_time = { 0, RUN_TIME_MS * 1000000l };
+    nanosleep(&sleep_time, NULL);
+    atomic_store(&g_run, false);
+
+    pthread_join(writer, NULL);
+    for(i = 0; i < thread_count; ++i) {
+        pthread_join(readers[i].thread, NULL);
+    }
+
+    uint64_t elapsed = now_ns() - start;
+
+    uint64_t total = 0;
+    for(i = 0; i < thread_count; ++i) {
+        total += readers[i].dispatch_count;
+        ecdc_free_console(readers[i].console);
+    }
+
+    return ((double) total * 1e9) / (double) elapsed;
+}
+
+int
+main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    g_registry = ecdc_alloc_registry(MAX_THREADS);
+    if(NULL == g_registry) {
+        fprintf(stderr, "Failed to allocate registry\n");
+        return 1;
+    }
+
+    fprintf(stdout, "threads,dispatches_per_sec,registry_writes\n");
+
+    size_t thread_count;
+    for(thread_count = 1; thread_count <= MAX_THREADS; thread_count *= 2) {
+        uint64_t churn_count;
+        double rate = run(thread_count, &churn_count);
+        fprintf(stdout, "%d,%.0f,%llu\n",
+                (int) thread_count, rate, (unsigned long long) churn_count);
+    }
+
+    ecdc_free_registry(g_registry);
+    return 0;
+}
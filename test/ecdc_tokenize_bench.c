@@ -0,0 +1,337 @@
+// clock_gettime, this is built as plain C99 and C11
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+
+// The tokenizer is private, so build the library into this benchmark
+#include "ecdc/ecdc.c"
+
+
+// ------------------------------------------------------------------- Settings
+
+#define MAX_ARGC                16
+#define BYTES_PER_RUN           (16ul * 1024ul * 1024ul)
+
+// Lengths of the lines that are split, in characters. The shortest is the
+// smallest arg_line size a console can have
+static const size_t LINE_LENGTHS[] = { 16, 32, 128, 512, 2048, 8192 };
+
+
+// ------------------------------------------------------------------- Helpers
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ull) + (uint64_t) ts.tv_nsec;
+}
+
+// Keeps the compiler from dropping the work
+static volatile uintptr_t g_sink;
+
+
+// -------------------------------------------------------- Previous tokenizer
+
+static char *
+legacy_find_first_non_whitespace(char * str)
+{
+    while(*str != '\0') {
+        switch(*str) {
+            case '\x20':
+            case '\x09':
+            case '\x0A':
+            case '\x0B':
+            case '\x0C':
+            case '\x0D':
+                ++str;
+                break;
+            default:
+                return str;
+        }
+    }
+    return NULL;
+}
+
+static char *
+legacy_find_first_whitespace(char * str)
+{
+    while(*str != '\0') {
+        switch(*str) {
+            case '\x20':
+            case '\x09':
+            case '\x0A':
+            case '\x0B':
+            case '\x0C':
+            case '\x0D':
+                return str;
+            default:
+                ++str;
+                break;
+        }
+    }
+    return NULL;
+}
+
+static void
+legacy_store(struct ecdc_console * console, const char * pattern, size_t len)
+{
+    // Lines were stored as typed
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        console->arg_line[i] = pattern[i];
+    }
+    console->arg_line_write_index = len;
+}
+
+static size_t
+legacy_complete(struct ecdc_console * console)
+{
+    // Then split once the line completed
+    char * line = console->arg_line;
+    line[console->arg_line_write_index] = '\0';
+
+    size_t argc = 0;
+    size_t i;
+    for(i = 0; i < console->max_argc; ++i) {
+        char * start = legacy_find_first_non_whitespace(line);
+        if(NULL == start) {
+            break;
+        }
+
+        console->argv[i] = start;
+        argc = i + 1;
+
+        char * stop = legacy_find_first_whitespace(start);
+        if(NULL == stop) {
+            break;
+        }
+        *stop = '\0';
+        line = stop + 1;
+    }
+    return argc;
+}
+
+
+// ----------------------------------------------------- One pass tokenizer
+
+static void
+split_store(struct ecdc_console * console, const char * pattern, size_t len)
+{
+    // Lines were stored as typed
+    legacy_store(console, pattern, len);
+}
+
+static char *
+split_skip_argument(char * str, const char * end)
+{
+    while((end - str) >= (ptrdiff_t) sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, str, sizeof(word));
+        if(SWAR_HAS_LESS_THAN(word, 0x21)) {
+            break;
+        }
+        str += sizeof(word);
+    }
+
+    while(CHAR_CLASS(*str) == CHAR_ARGUMENT) {
+        ++str;
+    }
+    return str;
+}
+
+static size_t
+split_complete(struct ecdc_console * console)
+{
+    // Then split in one pass, skipping a word at a time within arguments
+    char * line = console->arg_line;
+    const char * end = &line[console->arg_line_write_index];
+    *((char *) end) = '\0';
+
+    size_t argc = 0;
+    while(argc < console->max_argc) {
+        while(CHAR_CLASS(*line) == CHAR_SEPARATOR) {
+            ++line;
+        }
+        if(CHAR_CLASS(*line) == CHAR_END) {
+            break;
+        }
+
+        console->argv[argc++] = line;
+
+        line = split_skip_argument(line, end);
+        if(CHAR_CLASS(*line) == CHAR_END) {
+            break;
+        }
+        *line++ = '\0';
+    }
+    return argc;
+}
+
+
+// --------------------------------------------------- Per character tracking
+
+static void
+track_store(struct ecdc_console * console, const char * pattern, size_t len)
+{
+    // Read as a block of input, arguments are tracked as each character is
+    // stored
+    arg_line_clear(console);
+    console->rx_ptr = pattern;
+    console->rx_len = len;
+    console->budget = (size_t) -1;
+    console->f_input_eof = false;
+
+    while(0 < console->rx_len) {
+        arg_line_append(console, (char) term_getc_raw(console));
+    }
+}
+
+static size_t
+track_complete(struct ecdc_console * console)
+{
+    return console->argc;
+}
+
+
+// ------------------------------------------------------- Current tokenizer
+
+static void
+current_store(struct ecdc_console * console, const char * pattern, size_t len)
+{
+    // Read as a block of input: runs of printable characters are stored at
+    // once, and the rest one at a time
+    arg_line_clear(console);
+    console->rx_ptr = pattern;
+    console->rx_len = len;
+    console->budget = (size_t) -1;
+    console->f_input_eof = false;
+
+    while(0 < console->rx_len) {
+        size_t run_len;
+        const char * run = term_read_run(console, (size_t) -1, &run_len);
+        if(NULL != run) {
+            arg_line_append_run(console, run, run_len);
+        } else {
+            arg_line_append(console, (char) term_getc_raw(console));
+        }
+    }
+}
+
+static size_t
+current_complete(struct ecdc_console * console)
+{
+    return console->argc;
+}
+
+
+// ---------------------------------------------------------------------- Main
+
+typedef void (*store_fn)(struct ecdc_console *, const char *, size_t);
+typedef size_t (*complete_fn)(struct ecdc_console *);
+
+struct result {
+    double                      store_ns;
+    double                      complete_ns;
+};
+
+static void
+null_puts(void * console_hint, const char * s, size_t len)
+{
+    (void) console_hint;
+    (void) s;
+    (void) len;
+}
+
+// Fills line with MAX_ARGC arguments of roughly equal length
+static void
+make_line(char * line, size_t len)
+{
+    size_t arg_len = len / MAX_ARGC;
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        bool separator = (arg_len > 1) ? ((i % arg_len) == (arg_len - 1))
+                                       : ((i % 2) == 1);
+        line[i] = separator ? ' ' : (char) ('a' + (i % 26));
+    }
+    line[len] = '\0';
+}
+
+// Times storing the characters of a line, and the work left when the line
+// completes. The second is what the Enter key costs
+static struct result
+run(store_fn store, complete_fn complete, size_t len)
+{
+    char * pattern = (char *) malloc(len + 1);
+    struct ecdc_console * console =
+        ecdc_alloc_console(NULL, NULL, null_puts, len, MAX_ARGC);
+
+    make_line(pattern, len);
+
+    size_t iterations = BYTES_PER_RUN / len;
+    uint64_t store_time = 0;
+    uint64_t complete_time = 0;
+
+    size_t i;
+    for(i = 0; i < iterations; ++i) {
+        uint64_t start = now_ns();
+        store(console, pattern, len);
+        uint64_t stored = now_ns();
+        size_t argc = complete(console);
+        uint64_t completed = now_ns();
+
+        store_time += stored - start;
+        complete_time += completed - stored;
+        g_sink += argc + (uintptr_t) console->argv[argc - 1];
+    }
+
+    ecdc_free_console(console);
+    free(pattern);
+
+    struct result result = {
+        (double) store_time / (double) iterations,
+        (double) complete_time / (double) iterations,
+    };
+    return result;
+}
+
+// Prints one row per line length, with two columns for each tokenizer: the
+// time to store the characters of a line, and the time left for when the line
+// completes. Every time includes one clock_gettime call
+int
+main(int argc, char const *argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    fprintf(stdout, "line_length,"
+                    "legacy_store_ns,legacy_complete_ns,"
+                    "split_store_ns,split_complete_ns,"
+                    "track_store_ns,track_complete_ns,"
+                    "current_store_ns,current_complete_ns\n");
+
+    size_t i;
+    for(i = 0; i < (sizeof(LINE_LENGTHS) / sizeof(LINE_LENGTHS[0])); ++i) {
+        size_t len = LINE_LENGTHS[i];
+        struct result legacy = run(legacy_store, legacy_complete, len);
+        struct result split = run(split_store, split_complete, len);
+        struct result track = run(track_store, track_complete, len);
+        struct result current = run(current_store, current_complete, len);
+        fprintf(stdout, "%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+                (int) len,
+                legacy.store_ns, legacy.complete_ns,
+                split.store_ns, split.complete_ns,
+                track.store_ns, track.complete_ns,
+                current.store_ns, current.complete_ns);
+    }
+
+    return 0;
+}
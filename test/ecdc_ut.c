@@ -21,6 +21,8 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "ecdc/ecdc.h"
@@ -32,10 +34,13 @@ struct simple_buf {
     char *      read_data;
     size_t      read_data_size;
     size_t      read_index;
+    size_t      read_calls;
 
     char *      write_data;
     size_t      write_data_size;
     size_t      write_index;
+    size_t      write_calls;
+    size_t      write_limit;
 };
 
 
@@ -46,10 +51,13 @@ alloc_simple_buf(size_t size) {
     buf->read_data = (char *) malloc(size*sizeof(char));
     buf->read_data_size = size;
     buf->read_index = 0;
+    buf->read_calls = 0;
 
     buf->write_data = (char *) malloc(size*sizeof(char));
     buf->write_data_size = size;
     buf->write_index = 0;
+    buf->write_calls = 0;
+    buf->write_limit = size;
 
     return buf;
 }
@@ -61,10 +69,12 @@ realloc_and_reset(struct simple_buf * buf, size_t size)
     buf->read_data = (char *) realloc(buf->read_data, size);
     buf->read_data_size = size;
     buf->read_index = 0;
+    buf->read_calls = 0;
 
     buf->write_data = (char *) realloc(buf->write_data, size);
     buf->write_data_size = size;
     buf->write_index = 0;
+    buf->write_calls = 0;
 }
 
 
@@ -82,6 +92,8 @@ mock_puts(void * hint, const char * c, size_t len)
 {
     if(NULL != hint) {
         struct simple_buf * buf = (struct simple_buf *) hint;
+        ++buf->write_calls;
+
         size_t idx;
         for(idx = 0; idx < len; ++idx) {
             if(buf->write_index < buf->write_data_size) {
@@ -95,6 +107,20 @@ mock_puts(void * hint, const char * c, size_t len)
 }
 
 
+static bool
+written_contains(struct simple_buf * buf, const char * str)
+{
+    size_t len = strlen(str);
+    size_t idx;
+    for(idx = 0; (idx + len) <= buf->write_index; ++idx) {
+        if(0 == memcmp(&buf->write_data[idx], str, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
 static int
 mock_getc(void * hint)
 {
@@ -112,6 +138,25 @@ mock_getc(void * hint)
 }
 
 
+static size_t
+mock_read(void * hint, char * c, size_t max)
+{
+    size_t len = 0;
+
+    if(NULL != hint) {
+        struct simple_buf * buf = (struct simple_buf *) hint;
+        ++buf->read_calls;
+        while((len < max) && (buf->read_index < buf->read_data_size)) {
+            c[len] = buf->read_data[buf->read_index];
+            ++buf->read_index;
+            ++len;
+        }
+    }
+
+    return len;
+}
+
+
 
 static void
 mock_callback(void * hint, int argc, char const * argv[])
@@ -122,6 +167,19 @@ mock_callback(void * hint, int argc, char const * argv[])
 }
 
 
+static void
+mock_flag_callback(void * hint, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    if(NULL != hint) {
+        bool * was_called = (bool *) hint;
+        *was_called = true;
+    }
+}
+
+
 
 static int
 test_alloc_1(void)
@@ -463,90 +521,381 @@ test_parse_2(void)
 
 
 
+static int
+test_bulk_read(void)
+{
+    describe("embedded-c-debug-console can read input in blocks") {
+
+        static const char TEST_STRING[] =
+            "x\r"
+            "cmd_1 arg_1 arg_2 arg_3 a_very_long_argument_that_spans_more_than_"
+            "one_read_block_of_input\r";
+        // No trailing '\0', the line should dispatch on the '\r'
+        struct simple_buf * read_buffer = alloc_simple_buf(sizeof(TEST_STRING) - 1);
+        memcpy(read_buffer->read_data, TEST_STRING, sizeof(TEST_STRING) - 1);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a bulk console") {
+            console = ecdc_alloc_console_bulk(
+                read_buffer, mock_read, mock_puts, 120, 6, 64);
+            assert_not_null(console);
+        }
+
+        bool cmd_1_called = false;
+        struct ecdc_command * cmd_1 = NULL;
+        it("can allocate a command") {
+            cmd_1 = ecdc_alloc_command(
+                &cmd_1_called,
+                console,
+                "cmd_1",
+                mock_flag_callback);
+            assert_not_null(cmd_1);
+        }
+
+        it("can process all buffered input in a single pump") {
+            ecdc_pump_console(console);
+
+            assert_ok(read_buffer->read_index == read_buffer->read_data_size);
+            assert_ok(cmd_1_called);
+        }
+
+        it("can read in blocks instead of characters") {
+            assert_ok(read_buffer->read_calls <= 3);
+        }
+
+        it("can free a command") {
+            ecdc_free_command(cmd_1);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(read_buffer);
+    }
+
+    return assert_failures();
+}
+
+
+
 static void
-test_prompt_write_cmd_1(void * hint, int argc, char const * argv[])
+test_output_buffer_cmd_1(void * hint, int argc, char const * argv[])
 {
     (void) argc;
     (void) argv;
 
-    assert_not_null(hint);
-    if(NULL != hint) {
-        bool * was_called = (bool *) hint;
-        *was_called = true;
-    }
+    struct ecdc_console * console = (struct ecdc_console *) hint;
+    ecdc_puts(console, "line 1\nline 2\n");
 }
 
 
 static int
-test_prompt_write(void)
+test_output_buffer(void)
 {
-    describe("embedded-c-debug-console can print a console") {
+    describe("embedded-c-debug-console can combine output writes") {
 
-        struct simple_buf * buf = alloc_simple_buf(32);
-        buf->read_index = buf->read_data_size;
+        static const char TEST_STRING[] = "x\rcmd_1 arg_1\r";
+        struct simple_buf * buf = alloc_simple_buf(256);
+        memcpy(buf->read_data, TEST_STRING, sizeof(TEST_STRING) - 1);
+        buf->read_data_size = sizeof(TEST_STRING) - 1;
 
         struct ecdc_console * console = NULL;
-        it("can allocate a console") {
-            console = ecdc_alloc_console(buf, mock_getc, mock_puts, 80, 6);
+        it("can allocate a bulk console") {
+            console = ecdc_alloc_console_bulk(buf, mock_read, mock_puts, 80, 6, 64);
             assert_not_null(console);
         }
 
-        bool cmd_1_called = false;
+        it("can allocate an output buffer") {
+            assert_ok(0 == ecdc_alloc_output_buffer(console, 128));
+        }
+
         struct ecdc_command * cmd_1 = NULL;
         it("can allocate a command") {
             cmd_1 = ecdc_alloc_command(
-                &cmd_1_called,
+                console,
                 console,
                 "cmd_1",
-                test_prompt_write_cmd_1);
+                test_output_buffer_cmd_1);
             assert_not_null(cmd_1);
         }
 
-        it("will not print a prompt until the first user input") {
+        it("can write all output from a pump with one puts call") {
+            ecdc_pump_console(console);
+
+            assert_ok(buf->write_calls == 1);
+            assert_ok(buf->write_index > 0);
+        }
+
+        it("can flush output written outside of a pump") {
+            buf->write_calls = 0;
+            ecdc_puts(console, "hello\n");
+            assert_ok(buf->write_calls == 1);
+        }
+
+        it("can remove the output buffer") {
+            assert_ok(0 == ecdc_alloc_output_buffer(console, 0));
+
+            buf->write_calls = 0;
+            ecdc_puts(console, "a\nb");
+            assert_ok(buf->write_calls == 3);
+        }
+
+        it("can free a command") {
+            ecdc_free_command(cmd_1);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+
+static void
+test_many_commands_callback(void * hint, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    if(NULL != hint) {
+        int * call_count = (int *) hint;
+        ++(*call_count);
+    }
+}
+
+
+static int
+test_many_commands(void)
+{
+    describe("embedded-c-debug-console can look up many commands") {
+
+        enum { COMMAND_COUNT = 100 };
+
+        struct simple_buf * buf = alloc_simple_buf(64);
+        buf->read_data_size = 0;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a bulk console") {
+            console = ecdc_alloc_console_bulk(buf, mock_read, mock_puts, 80, 6, 64);
+            assert_not_null(console);
+        }
+
+        int call_counts[COMMAND_COUNT];
+        struct ecdc_command * commands[COMMAND_COUNT];
+        it("can register commands in unsorted order") {
             int i;
-            for(i = 0; i < 30; ++i) {
-                ecdc_pump_console(console);
+            for(i = 0; i < COMMAND_COUNT; ++i) {
+                char name[16];
+                snprintf(name, sizeof(name), "cmd_%d", (i * 37) % COMMAND_COUNT);
+                call_counts[i] = 0;
+                commands[i] = ecdc_alloc_command(
+                    &call_counts[i],
+                    console,
+                    name,
+                    test_many_commands_callback);
+                assert_not_null(commands[i]);
             }
-
-            assert_ok(buf->write_index == 0);
         }
 
-        // Write an input char
-        buf->read_index = buf->read_data_size - 1;
-        buf->read_data[buf->read_index] = ' ';
+        it("will not register a duplicate command") {
+            assert_null(ecdc_alloc_command(
+                NULL, console, "cmd_37", test_many_commands_callback));
+        }
 
-        it("can print a prompt") {
+        it("can dispatch every registered command") {
             int i;
-            for(i = 0; i < 30; ++i) {
+            for(i = 0; i < COMMAND_COUNT; ++i) {
+                int len = snprintf(buf->read_data, 64,
+                    "\rcmd_%d\r", (i * 37) % COMMAND_COUNT);
+                buf->read_data_size = len;
+                buf->read_index = 0;
                 ecdc_pump_console(console);
             }
 
-            assert_ok(buf->write_index > 0);
+            for(i = 0; i < COMMAND_COUNT; ++i) {
+                assert_ok(1 == call_counts[i]);
+            }
         }
 
-        static const char TEST_STRING_1[] = "cmd_1 arg_2\r";
-        realloc_and_reset(buf, sizeof(TEST_STRING_1));
-        memcpy(buf->read_data, TEST_STRING_1, sizeof(TEST_STRING_1));
+        it("can still dispatch after freeing some commands") {
+            int i;
+            for(i = 0; i < COMMAND_COUNT; i += 2) {
+                ecdc_free_command(commands[i]);
+                commands[i] = NULL;
+            }
 
-        it("can print a prompt after calling a callback") {
-            assert_ok(buf->write_index == 0);
-            assert_ok(cmd_1_called == false);
+            int len = snprintf(buf->read_data, 64, "\rcmd_37\rcmd_0\r");
+            buf->read_data_size = len;
+            buf->read_index = 0;
+            ecdc_pump_console(console);
+
+            assert_ok(2 == call_counts[1]);
+            assert_ok(1 == call_counts[0]);
+        }
 
+        it("can free a console with commands registered") {
+            ecdc_free_console(console);
+        }
+
+        it("can free the remaining commands") {
             int i;
-            for(i = 0; i < 30; ++i) {
-                ecdc_pump_console(console);
+            for(i = 1; i < COMMAND_COUNT; i += 2) {
+                ecdc_free_command(commands[i]);
             }
+        }
 
-            assert_ok(buf->write_index > 0);
-            assert_ok(cmd_1_called == true);
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+
+#if ECDC_ENABLE_STATIC_COMMANDS
+
+static int static_cmd_call_count = 0;
+
+static void
+test_static_command_callback(void * hint, int argc, char const * argv[])
+{
+    assert_ok(hint == &static_cmd_call_count);
+    assert_ok(argc == 2);
+    if(argc == 2) {
+        assert_str_equal(argv[0], "static_cmd");
+        assert_str_equal(argv[1], "arg_1");
+    }
+
+    ++static_cmd_call_count;
+}
+
+ECDC_COMMAND("static_cmd", test_static_command_callback, &static_cmd_call_count);
+
+
+static int
+test_static_command(void)
+{
+    describe("embedded-c-debug-console can dispatch static commands") {
+
+        static const char TEST_STRING[] = "\rstatic_cmd arg_1\r";
+        struct simple_buf * buf = alloc_simple_buf(sizeof(TEST_STRING) - 1);
+        memcpy(buf->read_data, TEST_STRING, sizeof(TEST_STRING) - 1);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a bulk console") {
+            console = ecdc_alloc_console_bulk(buf, mock_read, mock_puts, 80, 6, 64);
+            assert_not_null(console);
+        }
+
+        it("will not register a command that shadows a static command") {
+            assert_null(ecdc_alloc_command(
+                NULL, console, "static_cmd", mock_callback));
+        }
+
+        it("can dispatch a static command") {
+            ecdc_pump_console(console);
+            assert_ok(1 == static_cmd_call_count);
         }
 
         it("can free a console") {
             ecdc_free_console(console);
         }
 
-        it("can free a command") {
-            ecdc_free_command(cmd_1);
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+#endif /* ECDC_ENABLE_STATIC_COMMANDS */
+
+
+
+static int
+test_static_storage(void)
+{
+    describe("embedded-c-debug-console can run from caller provided storage") {
+
+        enum { COMMAND_COUNT = 6, INDEX_COUNT = 4 };
+
+        // One extra byte, so that the console can be placed unaligned
+        enum {
+            CONSOLE_STORAGE_SIZE = ECDC_CONSOLE_STORAGE_SIZE(80, 6, INDEX_COUNT)
+                + ECDC_BUFFER_STORAGE_SIZE(32)
+        };
+        static char console_storage[CONSOLE_STORAGE_SIZE + 1];
+        static char command_storage[COMMAND_COUNT][ECDC_COMMAND_STORAGE_SIZE(8)];
+
+        struct simple_buf * buf = alloc_simple_buf(64);
+        buf->read_data_size = 0;
+
+        it("will not initialize a console in storage that is too small") {
+            assert_null(ecdc_init_console_bulk(
+                console_storage, 16,
+                buf, mock_read, mock_puts, 80, 6, INDEX_COUNT, 32));
+        }
+
+        struct ecdc_console * console = NULL;
+        it("can initialize a console") {
+            console = ecdc_init_console_bulk(
+                console_storage + 1, CONSOLE_STORAGE_SIZE,
+                buf, mock_read, mock_puts, 80, 6, INDEX_COUNT, 32);
+            assert_not_null(console);
+            assert_ok((char *) console >= console_storage);
+            assert_ok((char *) console < console_storage + sizeof(console_storage));
+        }
+
+        it("can keep a reference to the prompt") {
+            ecdc_replace_prompt(console, "> ");
+        }
+
+        int call_counts[COMMAND_COUNT];
+        struct ecdc_command * commands[COMMAND_COUNT];
+        it("can initialize more commands than the index holds") {
+            int i;
+            for(i = 0; i < COMMAND_COUNT; ++i) {
+                char name[16];
+                snprintf(name, sizeof(name), "cmd_%d", i);
+                call_counts[i] = 0;
+                commands[i] = ecdc_init_command(
+                    command_storage[i],
+                    sizeof(command_storage[i]),
+                    &call_counts[i],
+                    console,
+                    name,
+                    test_many_commands_callback);
+                assert_not_null(commands[i]);
+            }
+        }
+
+        it("can dispatch every command") {
+            int len = snprintf(buf->read_data, 64,
+                "\rcmd_0\rcmd_3\rcmd_5\r");
+            buf->read_data_size = len;
+            buf->read_index = 0;
+            ecdc_pump_console(console);
+
+            assert_ok(1 == call_counts[0]);
+            assert_ok(1 == call_counts[3]);
+            assert_ok(1 == call_counts[5]);
+            assert_ok(NULL != memchr(buf->write_data, '>', buf->write_index));
+        }
+
+        it("can free the commands") {
+            int i;
+            for(i = 0; i < COMMAND_COUNT; ++i) {
+                ecdc_free_command(commands[i]);
+            }
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
         }
 
         free_simple_buf(buf);
@@ -557,6 +906,2005 @@ test_prompt_write(void)
 
 
 
+static int
+test_command_pool(void)
+{
+    describe("embedded-c-debug-console can allocate commands from a pool") {
+
+        enum { POOL_COUNT = 4 };
+
+        static char console_storage[
+            ECDC_CONSOLE_STORAGE_SIZE(80, 6, POOL_COUNT)
+            + ECDC_COMMAND_POOL_STORAGE_SIZE(POOL_COUNT, 8)];
+
+        struct ecdc_console * console = NULL;
+        it("can initialize a console") {
+            console = ecdc_init_console(
+                console_storage, sizeof(console_storage),
+                NULL, mock_getc, mock_puts, 80, 6, POOL_COUNT);
+            assert_not_null(console);
+        }
+
+        it("can allocate a command pool") {
+            assert_ok(0 == ecdc_alloc_command_pool(console, POOL_COUNT, 8));
+        }
+
+        it("will not allocate a second command pool") {
+            assert_ok(0 != ecdc_alloc_command_pool(console, POOL_COUNT, 8));
+        }
+
+        struct ecdc_command * commands[POOL_COUNT];
+        it("can allocate every command in the pool") {
+            int i;
+            for(i = 0; i < POOL_COUNT; ++i) {
+                char name[16];
+                snprintf(name, sizeof(name), "cmd_%d", i);
+                commands[i] = ecdc_alloc_command(NULL, console, name, mock_callback);
+                assert_not_null(commands[i]);
+                assert_ok((char *) commands[i] >= console_storage);
+                assert_ok((char *) commands[i] < console_storage + sizeof(console_storage));
+            }
+        }
+
+        it("will not use the heap when the pool is empty") {
+            assert_null(ecdc_alloc_command(NULL, console, "cmd_x", mock_callback));
+        }
+
+        it("will not take a name that is too long for the pool") {
+            ecdc_free_command(commands[0]);
+            assert_null(ecdc_alloc_command(
+                NULL, console, "long_command_name", mock_callback));
+        }
+
+        it("can reuse a freed pool command") {
+            struct ecdc_command * cmd = ecdc_alloc_command(
+                NULL, console, "cmd_y", mock_callback);
+            assert_ok(cmd == commands[0]);
+            commands[0] = cmd;
+        }
+
+        it("can free the pool commands") {
+            int i;
+            for(i = 0; i < POOL_COUNT; ++i) {
+                ecdc_free_command(commands[i]);
+            }
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+    }
+
+    describe("embedded-c-debug-console can free the console before pool commands") {
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console with a pool") {
+            console = ecdc_alloc_console(NULL, mock_getc, mock_puts, 80, 6);
+            assert_not_null(console);
+            assert_ok(0 == ecdc_alloc_command_pool(console, 4, 8));
+        }
+
+        struct ecdc_command * command_1 = NULL;
+        struct ecdc_command * command_2 = NULL;
+        it("can allocate commands from the pool") {
+            command_1 = ecdc_alloc_command(NULL, console, "cmd_1", mock_callback);
+            command_2 = ecdc_alloc_command(NULL, console, "cmd_2", mock_callback);
+            assert_not_null(command_1);
+            assert_not_null(command_2);
+        }
+
+        it("can free the console") {
+            ecdc_free_console(console);
+        }
+
+        it("can free the commands after the console") {
+            ecdc_free_command(command_1);
+            ecdc_free_command(command_2);
+        }
+    }
+
+    return assert_failures();
+}
+
+
+
+static int
+test_command_group(void)
+{
+    describe("embedded-c-debug-console can free a group of commands") {
+
+        enum { COMMAND_COUNT = 6 };
+
+        struct simple_buf * buf = alloc_simple_buf(256);
+        buf->read_data_size = 0;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a bulk console") {
+            console = ecdc_alloc_console_bulk(buf, mock_read, mock_puts, 80, 6, 64);
+            assert_not_null(console);
+        }
+
+        int call_counts[COMMAND_COUNT];
+        it("can allocate commands in two groups") {
+            int i;
+            for(i = 0; i < COMMAND_COUNT; ++i) {
+                char name[16];
+                snprintf(name, sizeof(name), "cmd_%d", i);
+                call_counts[i] = 0;
+                struct ecdc_command * cmd = ecdc_alloc_command(
+                    &call_counts[i],
+                    console,
+                    name,
+                    test_many_commands_callback);
+                assert_not_null(cmd);
+                ecdc_set_command_group(cmd, 1 + (i % 2));
+            }
+        }
+
+        struct ecdc_command * list_cmd = NULL;
+        it("can allocate a list command") {
+            list_cmd = ecdc_alloc_list_command(console, "ls");
+            assert_not_null(list_cmd);
+        }
+
+        it("can free a group") {
+            ecdc_free_command_group(console, 1);
+        }
+
+        it("can list the remaining commands in registration order") {
+            int len = snprintf(buf->read_data, 64, "\rls\r");
+            buf->read_data_size = len;
+            buf->read_index = 0;
+            buf->write_index = 0;
+            ecdc_pump_console(console);
+
+            assert_ok(written_contains(buf, "cmd_1\r\ncmd_3\r\ncmd_5\r\nls\r\n"));
+        }
+
+        it("can dispatch the remaining commands") {
+            int len = snprintf(buf->read_data, 64, "cmd_0\rcmd_1\r");
+            buf->read_data_size = len;
+            buf->read_index = 0;
+            ecdc_pump_console(console);
+
+            assert_ok(0 == call_counts[0]);
+            assert_ok(1 == call_counts[1]);
+        }
+
+        it("can free the other group and register the names again") {
+            ecdc_free_command_group(console, 2);
+            struct ecdc_command * cmd = ecdc_alloc_command(
+                NULL, console, "cmd_1", mock_callback);
+            assert_not_null(cmd);
+        }
+
+        it("can free the rest of the commands") {
+            ecdc_free_command_group(console, 0);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+
+static int
+test_pump_budget_deadline(void * hint)
+{
+    (void) hint;
+    return 1;
+}
+
+
+static int
+test_pump_budget(void)
+{
+    describe("embedded-c-debug-console can bound the work done per pump") {
+
+        static const char TEST_STRING[] = "\rcmd_1 a\rcmd_1 b\r";
+        struct simple_buf * buf = alloc_simple_buf(sizeof(TEST_STRING) - 1);
+        memcpy(buf->read_data, TEST_STRING, sizeof(TEST_STRING) - 1);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, mock_getc, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        int call_count = 0;
+        struct ecdc_command * cmd_1 = NULL;
+        it("can allocate a command") {
+            cmd_1 = ecdc_alloc_command(
+                &call_count, console, "cmd_1", test_many_commands_callback);
+            assert_not_null(cmd_1);
+        }
+
+        it("can stop when the character budget is used up") {
+            assert_ok(0 < ecdc_pump_console_budget(console, 4, NULL));
+            assert_ok(4 == buf->read_index);
+            assert_ok(0 == call_count);
+        }
+
+        it("can stop at a deadline") {
+            assert_ok(0 < ecdc_pump_console_budget(
+                console, (size_t) -1, test_pump_budget_deadline));
+            assert_ok(buf->read_index < buf->read_data_size);
+        }
+
+        it("can drain all input with an unlimited budget") {
+            assert_ok(0 == ecdc_pump_console_budget(console, (size_t) -1, NULL));
+            assert_ok(buf->read_index == buf->read_data_size);
+            assert_ok(2 == call_count);
+        }
+
+        it("can stop within a block of bulk read input") {
+            static const char BULK_STRING[] = "cmd_1 d\rxy";
+            struct simple_buf * bulk_buf =
+                alloc_simple_buf(sizeof(BULK_STRING) - 1);
+            memcpy(bulk_buf->read_data, BULK_STRING, sizeof(BULK_STRING) - 1);
+
+            struct ecdc_console * bulk_console = ecdc_alloc_console_bulk(
+                bulk_buf, mock_read, mock_puts, 80, 6, 64);
+            assert_not_null(bulk_console);
+            struct ecdc_command * bulk_cmd = ecdc_alloc_command(
+                &call_count, bulk_console, "cmd_1", test_many_commands_callback);
+            assert_not_null(bulk_cmd);
+
+            // All 10 bytes are read in one block, but only 3 are processed
+            assert_ok(0 < ecdc_pump_console_budget(bulk_console, 3, NULL));
+            assert_ok(bulk_buf->read_index == bulk_buf->read_data_size);
+            assert_ok(2 == call_count);
+
+            assert_ok(0 < ecdc_pump_console_budget(bulk_console, 5, NULL));
+            assert_ok(3 == call_count);
+            assert_ok(0 == ecdc_pump_console_budget(
+                bulk_console, (size_t) -1, NULL));
+
+            ecdc_free_command(bulk_cmd);
+            ecdc_free_console(bulk_console);
+            free_simple_buf(bulk_buf);
+        }
+
+        it("can pump through an escape sequence") {
+            // A cursor key, then a command
+            static const char ESCAPE_STRING[] = "\x1B[Acmd_1 c\r";
+            struct simple_buf * esc_buf =
+                alloc_simple_buf(sizeof(ESCAPE_STRING) - 1);
+            memcpy(esc_buf->read_data, ESCAPE_STRING,
+                   sizeof(ESCAPE_STRING) - 1);
+
+            struct ecdc_console * esc_console =
+                ecdc_alloc_console(esc_buf, mock_getc, mock_puts, 80, 6);
+            assert_not_null(esc_console);
+            struct ecdc_command * esc_cmd = ecdc_alloc_command(
+                &call_count, esc_console, "cmd_1", test_many_commands_callback);
+            assert_not_null(esc_cmd);
+
+            assert_ok(0 == ecdc_pump_console_budget(
+                esc_console, (size_t) -1, NULL));
+            assert_ok(esc_buf->read_index == esc_buf->read_data_size);
+            assert_ok(4 == call_count);
+
+            ecdc_free_command(esc_cmd);
+            ecdc_free_console(esc_console);
+            free_simple_buf(esc_buf);
+        }
+
+        it("can free a command") {
+            ecdc_free_command(cmd_1);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+
+static void
+test_feed_callback(void * hint, int argc, char const * argv[])
+{
+    assert_ok(argc == 2);
+    if(argc == 2) {
+        assert_str_equal(argv[0], "cmd_1");
+        assert_str_equal(argv[1], "arg_1");
+    }
+
+    if(NULL != hint) {
+        int * call_count = (int *) hint;
+        ++(*call_count);
+    }
+}
+
+
+static void
+test_feed_long_callback(void * hint, int argc, char const * argv[])
+{
+    assert_ok(argc == 3);
+    if(argc == 3) {
+        assert_str_equal(argv[0], "a_long_command_name");
+        assert_str_equal(argv[1], "0123456789abcdef0123456789abcdef"
+                                  "0123456789abcdef");
+        assert_str_equal(argv[2], "x");
+    }
+
+    int * call_count = (int *) hint;
+    ++(*call_count);
+}
+
+
+static int
+test_feed(void)
+{
+    describe("embedded-c-debug-console can process pushed input") {
+
+        struct simple_buf * buf = alloc_simple_buf(256);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console without a read function") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        int call_count = 0;
+        struct ecdc_command * cmd_1 = NULL;
+        it("can allocate a command") {
+            cmd_1 = ecdc_alloc_command(
+                &call_count, console, "cmd_1", test_feed_callback);
+            assert_not_null(cmd_1);
+        }
+
+        it("can pump a console without a read function") {
+            ecdc_pump_console(console);
+            assert_ok(0 == buf->write_index);
+        }
+
+        it("can process a line split across feeds") {
+            static const char PART_1[] = "\rcmd_1 ar";
+            static const char PART_2[] = "g_1\rcmd_1 arg_1\r";
+            ecdc_feed(console, PART_1, sizeof(PART_1) - 1);
+            assert_ok(0 == call_count);
+
+            ecdc_feed(console, PART_2, sizeof(PART_2) - 1);
+            assert_ok(2 == call_count);
+            assert_ok(written_contains(buf, "cmd_1 arg_1"));
+        }
+
+        it("can split long arguments out of a block of input") {
+            // Long enough to be copied a word at a time
+            static const char TEST_STRING[] =
+                "a_long_command_name  0123456789abcdef0123456789abcdef"
+                "0123456789abcdef x\r";
+            int long_count = 0;
+            struct ecdc_command * cmd_long = ecdc_alloc_command(
+                &long_count, console, "a_long_command_name",
+                test_feed_long_callback);
+            assert_not_null(cmd_long);
+
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(1 == long_count);
+            assert_ok(written_contains(buf,
+                                       "a_long_command_name  0123456789abcdef"));
+
+            ecdc_free_command(cmd_long);
+        }
+
+        it("can free a command") {
+            ecdc_free_command(cmd_1);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+
+static int
+test_backspace_split(void)
+{
+    describe("embedded-c-debug-console splits arguments while reading") {
+
+        struct simple_buf * buf = alloc_simple_buf(512);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 80, 2);
+            assert_not_null(console);
+        }
+
+        int call_count = 0;
+        struct ecdc_command * cmd_1 = NULL;
+        it("can allocate a command") {
+            cmd_1 = ecdc_alloc_command(
+                &call_count, console, "cmd_1", test_feed_callback);
+            assert_not_null(cmd_1);
+        }
+
+        it("can split when arguments are backspaced away") {
+            static const char TEST_STRING[] =
+                "\rcmd_1  xy\x08\x08\x08" "arg_1\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(1 == call_count);
+        }
+
+        it("can split when backspacing into an argument") {
+            static const char TEST_STRING[] = "\rcmd_1 arg_2\x08\x7F_1\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(2 == call_count);
+        }
+
+        it("can split when backspacing past the first argument") {
+            static const char TEST_STRING[] =
+                "\rfoo\x08\x08\x08\x08" "cmd_1 arg_1\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(3 == call_count);
+        }
+
+        it("can ignore arguments past max_argc") {
+            static const char TEST_STRING[] =
+                "\rcmd_1 arg_1 extra\x08\x08\x08\x08\x08\x08\x08" "1\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(4 == call_count);
+        }
+
+        it("can free a command") {
+            ecdc_free_command(cmd_1);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+static int
+test_rx_ring(void)
+{
+    describe("embedded-c-debug-console can receive through a ring") {
+
+        struct simple_buf * buf = alloc_simple_buf(512);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console without a read function") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        it("will not allocate a ring that isn't a power of two") {
+            assert_ok(0 != ecdc_alloc_rx_ring(console, 24));
+        }
+
+        it("can allocate a ring") {
+            assert_ok(0 == ecdc_alloc_rx_ring(console, 16));
+        }
+
+        int call_count = 0;
+        struct ecdc_command * cmd_1 = NULL;
+        it("can allocate a command") {
+            cmd_1 = ecdc_alloc_command(
+                &call_count, console, "cmd_1", test_feed_callback);
+            assert_not_null(cmd_1);
+        }
+
+        it("can process lines that wrap around the ring") {
+            static const char TEST_STRING[] = "\rcmd_1 arg_1\r";
+            int i;
+            for(i = 0; i < 5; ++i) {
+                size_t len = sizeof(TEST_STRING) - 1;
+                assert_ok(len == ecdc_rx_isr_push(console, TEST_STRING, len));
+                ecdc_pump_console(console);
+            }
+
+            assert_ok(5 == call_count);
+            assert_ok(0 == ecdc_rx_overflow_count(console));
+        }
+
+        it("can count dropped characters") {
+            static const char TEST_STRING[] = "01234567890123456789";
+            assert_ok(16 == ecdc_rx_isr_push(console, TEST_STRING, 20));
+            assert_ok(0 == ecdc_rx_isr_push(console, TEST_STRING, 1));
+            assert_ok(5 == ecdc_rx_overflow_count(console));
+        }
+
+        it("can free space once the ring is pumped") {
+            ecdc_pump_console(console);
+            assert_ok(1 == ecdc_rx_isr_push(console, "\r", 1));
+        }
+
+        it("can free a command") {
+            ecdc_free_command(cmd_1);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+
+static void
+test_prompt_write_cmd_1(void * hint, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    assert_not_null(hint);
+    if(NULL != hint) {
+        bool * was_called = (bool *) hint;
+        *was_called = true;
+    }
+}
+
+
+static int
+test_prompt_write(void)
+{
+    describe("embedded-c-debug-console can print a console") {
+
+        struct simple_buf * buf = alloc_simple_buf(32);
+        buf->read_index = buf->read_data_size;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, mock_getc, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        bool cmd_1_called = false;
+        struct ecdc_command * cmd_1 = NULL;
+        it("can allocate a command") {
+            cmd_1 = ecdc_alloc_command(
+                &cmd_1_called,
+                console,
+                "cmd_1",
+                test_prompt_write_cmd_1);
+            assert_not_null(cmd_1);
+        }
+
+        it("will not print a prompt until the first user input") {
+            int i;
+            for(i = 0; i < 30; ++i) {
+                ecdc_pump_console(console);
+            }
+
+            assert_ok(buf->write_index == 0);
+        }
+
+        // Write an input char
+        buf->read_index = buf->read_data_size - 1;
+        buf->read_data[buf->read_index] = ' ';
+
+        it("can print a prompt") {
+            int i;
+            for(i = 0; i < 30; ++i) {
+                ecdc_pump_console(console);
+            }
+
+            assert_ok(buf->write_index > 0);
+        }
+
+        static const char TEST_STRING_1[] = "cmd_1 arg_2\r";
+        realloc_and_reset(buf, sizeof(TEST_STRING_1));
+        memcpy(buf->read_data, TEST_STRING_1, sizeof(TEST_STRING_1));
+
+        it("can print a prompt after calling a callback") {
+            assert_ok(buf->write_index == 0);
+            assert_ok(cmd_1_called == false);
+
+            int i;
+            for(i = 0; i < 30; ++i) {
+                ecdc_pump_console(console);
+            }
+
+            assert_ok(buf->write_index > 0);
+            assert_ok(cmd_1_called == true);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        it("can free a command") {
+            ecdc_free_command(cmd_1);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+
+static void
+test_count_callback(void * hint, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int * call_count = (int *) hint;
+    ++(*call_count);
+}
+
+static int
+test_completion(void)
+{
+    describe("embedded-c-debug-console can complete command names") {
+
+        struct simple_buf * buf = alloc_simple_buf(1024);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        int netstat_count = 0;
+        int network_count = 0;
+        int reboot_count = 0;
+        struct ecdc_command * netstat = NULL;
+        struct ecdc_command * network = NULL;
+        struct ecdc_command * reboot = NULL;
+        it("can allocate commands") {
+            netstat = ecdc_alloc_command(
+                &netstat_count, console, "netstat", test_count_callback);
+            network = ecdc_alloc_command(
+                &network_count, console, "network", test_count_callback);
+            reboot = ecdc_alloc_command(
+                &reboot_count, console, "reboot", test_count_callback);
+            assert_not_null(netstat);
+            assert_not_null(network);
+            assert_not_null(reboot);
+        }
+
+        it("can complete a unique prefix") {
+            static const char TEST_STRING[] = "\rreb\t\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(1 == reboot_count);
+            assert_ok(written_contains(buf, "reboot "));
+        }
+
+        it("can complete as far as the candidates agree") {
+            buf->write_index = 0;
+            static const char TEST_STRING[] = "\rn\ts\t\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(1 == netstat_count);
+            assert_ok(written_contains(buf, "netstat "));
+        }
+
+        it("can list candidates") {
+            buf->write_index = 0;
+            static const char TEST_STRING[] = "\rnet\t";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(written_contains(buf, "netstat\r\nnetwork\r\n"));
+            assert_ok(written_contains(buf, "network\r\n # "));
+            assert_ok(0 == memcmp(
+                &buf->write_data[buf->write_index - 3], "net", 3));
+        }
+
+        it("will not run a prefix unless enabled") {
+            buf->write_index = 0;
+            static const char TEST_STRING[] = "w\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(0 == network_count);
+            assert_ok(written_contains(buf, "'netw' not found"));
+        }
+
+        it("can run a unique prefix") {
+            ecdc_configure_console(console, ECDC_MODE_ANSI,
+                ECDC_SET_LOCAL_ECHO | ECDC_SET_PREFIX_MATCH);
+
+            static const char TEST_STRING[] = "netw\rnet\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(1 == network_count);
+            assert_ok(1 == netstat_count);
+            assert_ok(written_contains(buf, "'net' not found"));
+        }
+
+        it("can free commands") {
+            ecdc_free_command(netstat);
+            ecdc_free_command(network);
+            ecdc_free_command(reboot);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+static int
+test_history(void)
+{
+    describe("embedded-c-debug-console can recall history") {
+
+        struct simple_buf * buf = alloc_simple_buf(1024);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        it("will not allocate a history that can't hold a line") {
+            assert_ok(0 != ecdc_alloc_history(console, 4));
+        }
+
+        it("can allocate a history") {
+            assert_ok(0 == ecdc_alloc_history(console, 24));
+        }
+
+        int cmd_1_count = 0;
+        int cmd_2_count = 0;
+        struct ecdc_command * cmd_1 = NULL;
+        struct ecdc_command * cmd_2 = NULL;
+        it("can allocate commands") {
+            cmd_1 = ecdc_alloc_command(
+                &cmd_1_count, console, "cmd_1", test_count_callback);
+            cmd_2 = ecdc_alloc_command(
+                &cmd_2_count, console, "cmd_2", test_count_callback);
+            assert_not_null(cmd_1);
+            assert_not_null(cmd_2);
+        }
+
+        it("can recall the last line") {
+            static const char TEST_STRING[] = "\rcmd_1 arg_1\r\x1B[A\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(2 == cmd_1_count);
+            assert_ok(written_contains(buf, "\r\x1B[K"));
+        }
+
+        it("can recall older lines, and stop at the oldest") {
+            static const char TEST_STRING[] =
+                "cmd_2\r\x1B[A\x1B[A\x1B[A\x1B[A\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(1 == cmd_2_count);
+            assert_ok(3 == cmd_1_count);
+        }
+
+        it("can evict the oldest lines") {
+            // Only cmd_2 and the last cmd_1 fit in the ring now
+            static const char TEST_STRING[] =
+                "cmd_2\r\x1B[A\x1B[A\x1B[A\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(2 == cmd_2_count);
+            assert_ok(4 == cmd_1_count);
+        }
+
+        it("can move back to an empty line") {
+            static const char TEST_STRING[] = "\x1B[A\x1B[B\x1B[B\r";
+            ecdc_feed(console, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(2 == cmd_2_count);
+            assert_ok(4 == cmd_1_count);
+        }
+
+        it("can free commands") {
+            ecdc_free_command(cmd_1);
+            ecdc_free_command(cmd_2);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+static int
+test_resumable_callback(void * hint, void ** state, int argc, char const * argv[])
+{
+    (void) argc;
+    (void) argv;
+
+    int * call_count = (int *) hint;
+    ++(*call_count);
+
+    // Count the steps through the saved state
+    if(NULL == *state) {
+        *state = hint;
+    } else {
+        assert_ok(hint == *state);
+    }
+
+    return (0 != (*call_count % 3)) ? ECDC_CONTINUE : ECDC_DONE;
+}
+
+static int
+test_resumable(void)
+{
+    describe("embedded-c-debug-console can run resumable commands") {
+
+        static const char TEST_STRING[] = "\rres\rres\r";
+        struct simple_buf * buf = alloc_simple_buf(512);
+        memcpy(buf->read_data, TEST_STRING, sizeof(TEST_STRING) - 1);
+        buf->read_data_size = sizeof(TEST_STRING) - 1;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, mock_getc, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        int call_count = 0;
+        struct ecdc_command * res = NULL;
+        it("can allocate a resumable command") {
+            res = ecdc_alloc_resumable_command(
+                &call_count, console, "res", test_resumable_callback);
+            assert_not_null(res);
+        }
+
+        it("can run one step per pump") {
+            ecdc_pump_console(console);
+            assert_ok(1 == call_count);
+
+            // The prompt is held back, and input is left alone
+            size_t written = buf->write_index;
+            size_t read = buf->read_index;
+            ecdc_pump_console(console);
+            assert_ok(2 == call_count);
+            assert_ok(written == buf->write_index);
+            assert_ok(read == buf->read_index);
+        }
+
+        it("can finish and start the next command in the same pump") {
+            ecdc_pump_console(console);
+            assert_ok(4 == call_count);
+            assert_ok(written_contains(buf, "res\r\n # "));
+        }
+
+        it("can stop calling a command that is freed while running") {
+            ecdc_free_command(res);
+            ecdc_pump_console(console);
+            assert_ok(4 == call_count);
+        }
+
+        it("can hand fed input back when a command yields") {
+            static const char FEED_STRING[] = "again\rcount\r";
+            int again_count = 0;
+            int count_count = 0;
+            struct ecdc_command * again = ecdc_alloc_resumable_command(
+                &again_count, console, "again", test_resumable_callback);
+            struct ecdc_command * count = ecdc_alloc_command(
+                &count_count, console, "count", test_count_callback);
+            assert_not_null(again);
+            assert_not_null(count);
+
+            size_t len = sizeof(FEED_STRING) - 1;
+            size_t consumed = ecdc_feed(console, FEED_STRING, len);
+            assert_ok(consumed < len);
+            assert_ok(1 == again_count);
+            assert_ok(0 == count_count);
+
+            // Still running, so nothing more is taken
+            assert_ok(0 == ecdc_feed(console, &FEED_STRING[consumed],
+                                     len - consumed));
+            assert_ok(2 == again_count);
+
+            ecdc_pump_console(console);
+            assert_ok(3 == again_count);
+            assert_ok(len - consumed == ecdc_feed(console,
+                                                  &FEED_STRING[consumed],
+                                                  len - consumed));
+            assert_ok(1 == count_count);
+
+            ecdc_free_command(count);
+            ecdc_free_command(again);
+        }
+
+        it("can feed past a yield without touching the receive ring") {
+            static const char FEED_STRING[] = "again\r                    \r";
+            int again_count = 0;
+            struct ecdc_command * again = ecdc_alloc_resumable_command(
+                &again_count, console, "again", test_resumable_callback);
+            assert_not_null(again);
+            assert_ok(0 == ecdc_alloc_rx_ring(console, 16));
+
+            // The fed characters left over are not the ring's to release
+            size_t len = sizeof(FEED_STRING) - 1;
+            size_t consumed = ecdc_feed(console, FEED_STRING, len);
+            assert_ok(16 < (len - consumed));
+            assert_ok(16 == ecdc_rx_isr_push(console, FEED_STRING + 6, 17));
+            assert_ok(1 == ecdc_rx_overflow_count(console));
+
+            ecdc_pump_console(console);
+            ecdc_pump_console(console);
+            assert_ok(3 == again_count);
+            assert_ok(len - consumed == ecdc_feed(console,
+                                                  &FEED_STRING[consumed],
+                                                  len - consumed));
+            ecdc_pump_console(console);
+            assert_ok(1 == ecdc_rx_overflow_count(console));
+
+            ecdc_free_command(again);
+        }
+
+        it("can run a resumable command by a unique prefix") {
+            int prefix_count = 0;
+            struct ecdc_command * resume = ecdc_alloc_resumable_command(
+                &prefix_count, console, "resume", test_resumable_callback);
+            assert_not_null(resume);
+            ecdc_configure_console(console, ECDC_MODE_ANSI,
+                                   ECDC_SET_PREFIX_MATCH);
+
+            ecdc_feed(console, "resu\r", 5);
+            ecdc_pump_console(console);
+            ecdc_pump_console(console);
+            assert_ok(3 == prefix_count);
+
+            ecdc_configure_console(console, ECDC_MODE_ANSI, 0);
+            ecdc_free_command(resume);
+        }
+
+        it("can stop calling a command whose group is freed while running") {
+            int group_count = 0;
+            struct ecdc_command * grp = ecdc_alloc_resumable_command(
+                &group_count, console, "grp", test_resumable_callback);
+            assert_not_null(grp);
+            ecdc_set_command_group(grp, 5);
+
+            ecdc_feed(console, "grp\r", 4);
+            assert_ok(1 == group_count);
+
+            ecdc_free_command_group(console, 5);
+            ecdc_pump_console(console);
+            assert_ok(1 == group_count);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+static size_t
+mock_write(void * hint, const char * s, size_t len)
+{
+    // Accepts up to write_limit characters per call
+    struct simple_buf * buf = (struct simple_buf *) hint;
+    ++buf->write_calls;
+
+    if(len > buf->write_limit) {
+        len = buf->write_limit;
+    }
+    memcpy(&buf->write_data[buf->write_index], s, len);
+    buf->write_index += len;
+    return len;
+}
+
+static int
+test_output_queue(void)
+{
+    describe("embedded-c-debug-console can queue output") {
+
+        static const char TEST_STRING[] = "\rcmd_1\rcmd_1\r";
+        struct simple_buf * buf = alloc_simple_buf(512);
+        memcpy(buf->read_data, TEST_STRING, sizeof(TEST_STRING) - 1);
+        buf->read_data_size = sizeof(TEST_STRING) - 1;
+        buf->write_limit = 0;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, mock_getc, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        it("can allocate an output queue") {
+            assert_ok(0 != ecdc_alloc_output_queue(console, NULL, 16));
+            assert_ok(0 == ecdc_alloc_output_queue(console, mock_write, 16));
+            assert_ok(0 != ecdc_alloc_output_queue(console, mock_write, 16));
+        }
+
+        int call_count = 0;
+        struct ecdc_command * cmd_1 = NULL;
+        it("can allocate a command") {
+            cmd_1 = ecdc_alloc_command(
+                &call_count, console, "cmd_1", test_count_callback);
+            assert_not_null(cmd_1);
+        }
+
+        it("can queue what the transport doesn't accept") {
+            ecdc_pump_console(console);
+            assert_ok(0 == buf->write_index);
+            assert_ok(0 < ecdc_output_queue_depth(console));
+        }
+
+        it("can hold off input while the queue is congested") {
+            size_t read = buf->read_index;
+            ecdc_pump_console(console);
+            assert_ok(read == buf->read_index);
+            assert_ok(0 == call_count);
+        }
+
+        it("can drain the queue once the transport frees up") {
+            buf->write_limit = 512;
+            ecdc_flush(console);
+            assert_ok(0 == ecdc_output_queue_depth(console));
+            assert_ok(written_contains(buf, " # "));
+        }
+
+        it("can resume input") {
+            int i;
+            for(i = 0; i < 3; ++i) {
+                ecdc_pump_console(console);
+            }
+            assert_ok(2 == call_count);
+            assert_ok(written_contains(buf, "cmd_1\r\n"));
+            assert_ok(0 == ecdc_output_dropped_count(console));
+        }
+
+        it("can drop and count output that doesn't fit") {
+            buf->write_limit = 0;
+            ecdc_puts(console, "0123456789abcdef0123");
+            assert_ok(16 == ecdc_output_queue_depth(console));
+            assert_ok(0 < ecdc_output_dropped_count(console));
+        }
+
+        it("can free a command") {
+            ecdc_free_command(cmd_1);
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+static int
+test_out_reserve(void)
+{
+    describe("embedded-c-debug-console can write output in place") {
+
+        struct simple_buf * buf = alloc_simple_buf(512);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 80, 6);
+            assert_not_null(console);
+        }
+
+        it("will not reserve without an output buffer") {
+            assert_null(ecdc_out_reserve(console, 4));
+        }
+
+        it("will not reserve more than the output buffer") {
+            assert_ok(0 == ecdc_alloc_output_buffer(console, 16));
+            assert_null(ecdc_out_reserve(console, 17));
+        }
+
+        it("can translate committed output in place") {
+            char * out = ecdc_out_reserve(console, 8);
+            assert_not_null(out);
+            memcpy(out, "a\nb\x08" "c", 5);
+            ecdc_out_commit(console, 5);
+
+            assert_ok(1 == buf->write_calls);
+            assert_ok(8 == buf->write_index);
+            assert_ok(0 == memcmp(buf->write_data, "a\r\nb\x08 \x08" "c", 8));
+        }
+
+        it("can translate committed output that fills the buffer") {
+            buf->write_index = 0;
+            char * out = ecdc_out_reserve(console, 16);
+            assert_not_null(out);
+            memset(out, '\n', 16);
+            ecdc_out_commit(console, 16);
+
+            assert_ok(32 == buf->write_index);
+            assert_ok(0 == memcmp(buf->write_data, "\r\n\r\n\r\n\r\n", 8));
+        }
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+static int
+test_printf(void)
+{
+    describe("embedded-c-debug-console can write formatted output") {
+
+        struct simple_buf * buf = alloc_simple_buf(512);
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 80, 6);
+            assert_not_null(console);
+            assert_ok(0 == ecdc_alloc_output_buffer(console, 16));
+        }
+
+        it("can format integers") {
+            buf->write_index = 0;
+            assert_ok(33 == ecdc_printf(console, "%d %i %u %x %X %ld %lld %zu",
+                                        -12, 34, 56u, 0xabu, 0xcdu, -7l,
+                                        -9000000000ll, (size_t) 42));
+            assert_ok(33 == buf->write_index);
+            assert_ok(0 == memcmp(buf->write_data,
+                                  "-12 34 56 ab CD -7 -9000000000 42", 33));
+        }
+
+        it("can pad and align fields") {
+            buf->write_index = 0;
+            assert_ok(34 == ecdc_printf(console, "[%5d][%-5d][%05d][%#06x][%.3d]",
+                                        42, 42, -42, 0x1fu, 7));
+            assert_ok(0 == memcmp(buf->write_data,
+                                  "[   42][42   ][-0042][0x001f][007]", 34));
+        }
+
+        it("can format strings and characters") {
+            buf->write_index = 0;
+            assert_ok(16 == ecdc_printf(console, "%s|%4s|%-3c|%.2s|%%",
+                                        "ab", "cd", 'e', "fgh"));
+            assert_ok(0 == memcmp(buf->write_data, "ab|  cd|e  |fg|%", 16));
+        }
+
+        it("can format octal and the other integer lengths") {
+            buf->write_index = 0;
+            assert_ok(13 == ecdc_printf(console, "%o|%#o|%#o|%jd|%td", 8u, 8u,
+                                        0u, (intmax_t) -5, (ptrdiff_t) 6));
+            assert_ok(0 == memcmp(buf->write_data, "10|010|0|-5|6", 13));
+        }
+
+        it("can skip the arguments of unsupported conversions") {
+            buf->write_index = 0;
+            // Not a literal, so the compiler leaves the unknown one alone
+            const char * format = "%e|%Lg|%5q|%s";
+            assert_ok(12 == ecdc_printf(console, format, 1.5,
+                                        (long double) 2.5, "x"));
+            assert_ok(0 == memcmp(buf->write_data, "%e|%Lg|%5q|x", 12));
+        }
+
+        it("can translate newlines") {
+            buf->write_index = 0;
+            ecdc_configure_console(console, ECDC_MODE_ANSI, 0);
+            assert_ok(4 == ecdc_printf(console, "a\n%s", "b\n"));
+            assert_ok(6 == buf->write_index);
+            assert_ok(0 == memcmp(buf->write_data, "a\r\nb\r\n", 6));
+        }
+
+#if ECDC_ENABLE_PRINTF_FLOAT
+        it("can format fixed point") {
+            buf->write_index = 0;
+            assert_ok(25 == ecdc_printf(console, "%f %.2f %.0f %8.3f",
+                                        1.5, -2.005, 2.75, 3.14159));
+            assert_ok(0 == memcmp(buf->write_data,
+                                  "1.500000 -2.00 3    3.142", 25));
+        }
+#endif
+
+        it("can free a console") {
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+// CRC-16/XMODEM, a bit at a time, to check the console's against
+static unsigned int
+frame_crc(const unsigned char * s, size_t len)
+{
+    unsigned int crc = 0;
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        crc ^= (unsigned int) s[i] << 8;
+
+        int bit;
+        for(bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+            crc &= 0xFFFF;
+        }
+    }
+    return crc;
+}
+
+
+// SLIP encodes a request. crc_error is xor'd into the CRC
+static size_t
+frame_encode(char * out,
+             unsigned int id,
+             const char * line,
+             unsigned int crc_error)
+{
+    unsigned char raw[128];
+    size_t line_len = strlen(line);
+    size_t len = 0;
+
+    raw[len++] = (unsigned char) (id >> 8);
+    raw[len++] = (unsigned char) id;
+    memcpy(&raw[len], line, line_len);
+    len += line_len;
+
+    unsigned int crc = frame_crc(raw, len) ^ crc_error;
+    raw[len++] = (unsigned char) (crc >> 8);
+    raw[len++] = (unsigned char) crc;
+
+    size_t out_len = 0;
+    out[out_len++] = (char) ECDC_FRAME_END;
+
+    size_t i;
+    for(i = 0; i < len; ++i) {
+        if(ECDC_FRAME_END == raw[i]) {
+            out[out_len++] = (char) ECDC_FRAME_ESC;
+            out[out_len++] = (char) 0xDC;
+        } else if(ECDC_FRAME_ESC == raw[i]) {
+            out[out_len++] = (char) ECDC_FRAME_ESC;
+            out[out_len++] = (char) 0xDD;
+        } else {
+            out[out_len++] = (char) raw[i];
+        }
+    }
+
+    out[out_len++] = (char) ECDC_FRAME_END;
+    return out_len;
+}
+
+
+struct frame {
+    unsigned int        id;
+    int                 status;
+    unsigned char       data[128];
+    const char *        output;
+    size_t              output_len;
+};
+
+
+// Decodes the next response written, starting at offset. Returns false if
+// there isn't one, or if its CRC is wrong
+static bool
+frame_decode(struct simple_buf * buf, size_t * offset, struct frame * frame)
+{
+    const unsigned char * in = (const unsigned char *) buf->write_data;
+    size_t idx = *offset;
+
+    while((idx < buf->write_index) && (ECDC_FRAME_END != in[idx])) {
+        ++idx;
+    }
+    ++idx;
+
+    size_t len = 0;
+    while((idx < buf->write_index) && (ECDC_FRAME_END != in[idx])) {
+        unsigned char c = in[idx++];
+        if(ECDC_FRAME_ESC == c) {
+            c = (0xDC == in[idx++]) ? ECDC_FRAME_END : ECDC_FRAME_ESC;
+        }
+        if(len < sizeof(frame->data)) {
+            frame->data[len++] = c;
+        }
+    }
+    if((idx >= buf->write_index) || (len < 5) || (0 != frame_crc(frame->data, len))) {
+        return false;
+    }
+
+    *offset = idx + 1;
+    frame->id = ((unsigned int) frame->data[0] << 8) | frame->data[1];
+    frame->status = frame->data[len - 3];
+    frame->output = (const char *) &frame->data[2];
+    frame->output_len = len - 5;
+    return true;
+}
+
+
+static void
+test_frame_callback(void * hint, int argc, char const * argv[])
+{
+    struct ecdc_console * console = (struct ecdc_console *) hint;
+    ecdc_printf(console, "%d %s\n", argc, argv[argc - 1]);
+}
+
+
+static int
+test_framed(void)
+{
+    describe("embedded-c-debug-console can run commands in framed mode") {
+
+        struct simple_buf * buf = alloc_simple_buf(512);
+        char request[256];
+        struct frame frame;
+        size_t offset;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 16, 4);
+            assert_not_null(console);
+            assert_ok(0 == ecdc_alloc_output_buffer(console, 32));
+            ecdc_configure_console(console, ECDC_MODE_FRAMED, ECDC_SET_LOCAL_ECHO);
+        }
+
+        struct ecdc_command * command = NULL;
+        it("can allocate a command") {
+            command = ecdc_alloc_command(console, console, "led",
+                                         test_frame_callback);
+            assert_not_null(command);
+        }
+
+        it("can run a command, without echo or prompt") {
+            size_t len = frame_encode(request, 0x1234, "led on", 0);
+            ecdc_feed(console, request, len);
+
+            offset = 0;
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(0x1234 == frame.id);
+            assert_ok(ECDC_FRAME_STATUS_OK == frame.status);
+            assert_ok(5 == frame.output_len);
+            assert_ok(0 == memcmp(frame.output, "2 on\n", 5));
+            assert_ok(offset == buf->write_index);
+        }
+
+        it("can answer an empty request") {
+            buf->write_index = 0;
+            size_t len = frame_encode(request, 1, "", 0);
+            ecdc_feed(console, request, len);
+
+            offset = 0;
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(1 == frame.id);
+            assert_ok(ECDC_FRAME_STATUS_OK == frame.status);
+            assert_ok(0 == frame.output_len);
+        }
+
+        it("can report an unknown command") {
+            buf->write_index = 0;
+            size_t len = frame_encode(request, 2, "nope", 0);
+            ecdc_feed(console, request, len);
+
+            offset = 0;
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(2 == frame.id);
+            assert_ok(ECDC_FRAME_STATUS_NOT_FOUND == frame.status);
+            assert_ok(0 == frame.output_len);
+        }
+
+        it("will drop a request with a bad CRC") {
+            buf->write_index = 0;
+            size_t len = frame_encode(request, 3, "led on", 0x0100);
+            ecdc_feed(console, request, len);
+            assert_ok(0 == buf->write_index);
+        }
+
+        it("can escape framing characters") {
+            buf->write_index = 0;
+            size_t len = frame_encode(request, 0xC0DB, "led \xC0\xDB", 0);
+            ecdc_feed(console, request, len);
+
+            offset = 0;
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(0xC0DB == frame.id);
+            assert_ok(5 == frame.output_len);
+            assert_ok(0 == memcmp(frame.output, "2 \xC0\xDB\n", 5));
+        }
+
+        it("can run requests back to back, through line noise") {
+            buf->write_index = 0;
+            size_t len = 0;
+            memcpy(request, "zz", 2);
+            len += 2;
+            len += frame_encode(&request[len], 4, "led a", 0);
+            len += frame_encode(&request[len], 5, "led b", 0);
+            ecdc_feed(console, request, len);
+
+            offset = 0;
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(4 == frame.id);
+            assert_ok(0 == memcmp(frame.output, "2 a\n", 4));
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(5 == frame.id);
+            assert_ok(0 == memcmp(frame.output, "2 b\n", 4));
+        }
+
+        it("can report a request that overflows the line") {
+            buf->write_index = 0;
+            size_t len = frame_encode(request, 6, "led 0123456789abcdef", 0);
+            ecdc_feed(console, request, len);
+
+            offset = 0;
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(6 == frame.id);
+            assert_ok(ECDC_FRAME_STATUS_OVERFLOW == frame.status);
+            assert_ok(0 == frame.output_len);
+        }
+
+        it("can fit a request that fills the line") {
+            buf->write_index = 0;
+            size_t len = frame_encode(request, 7, "led 0123456789ab", 0);
+            ecdc_feed(console, request, len);
+
+            offset = 0;
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(ECDC_FRAME_STATUS_OK == frame.status);
+            assert_ok(0 == memcmp(frame.output, "2 0123456789ab\n", 15));
+        }
+
+        it("can send output from outside of a command") {
+            buf->write_index = 0;
+            ecdc_puts(console, "hi\n");
+
+            offset = 0;
+            assert_ok(frame_decode(buf, &offset, &frame));
+            assert_ok(ECDC_FRAME_ID_NOTIFY == frame.id);
+            assert_ok(ECDC_FRAME_STATUS_OK == frame.status);
+            assert_ok(3 == frame.output_len);
+            assert_ok(0 == memcmp(frame.output, "hi\n", 3));
+        }
+
+        it("can go back to ANSI mode") {
+            buf->write_index = 0;
+            ecdc_configure_console(console, ECDC_MODE_ANSI, 0);
+            ecdc_feed(console, "led x\r", 6);
+            assert_ok(written_contains(buf, "2 x\r\n"));
+        }
+
+        it("can free a console") {
+            ecdc_free_command(command);
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+static int
+test_batch(void)
+{
+    describe("embedded-c-debug-console can run pasted scripts in batch mode") {
+
+        struct simple_buf * buf = alloc_simple_buf(512);
+        int led_count = 0;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 16, 4);
+            assert_not_null(console);
+            ecdc_configure_console(console, ECDC_MODE_ANSI,
+                ECDC_SET_LOCAL_ECHO | ECDC_SET_BATCH_CONTROL);
+        }
+
+        struct ecdc_command * command = NULL;
+        it("can allocate a command") {
+            command = ecdc_alloc_command(&led_count, console, "led",
+                                         test_count_callback);
+            assert_not_null(command);
+        }
+
+        it("can run lines without echo or prompts") {
+            static const char SCRIPT[] = "\x02" "led a\r\nnope\nled b\r\rled";
+            ecdc_feed(console, "\r", 1);
+            buf->write_index = 0;
+            ecdc_feed(console, SCRIPT, sizeof(SCRIPT) - 1);
+
+            assert_ok(2 == led_count);
+            assert_ok(0 == buf->write_index);
+        }
+
+        it("can summarize the batch when it ends") {
+            ecdc_feed(console, "x\x03", 2);
+
+            assert_ok(2 == led_count);
+            assert_ok(written_contains(buf, "batch: 5 lines, 2 failed: 2 5\r\n"));
+            assert_ok(written_contains(buf, "\r\n # "));
+        }
+
+        it("can count lines that overflow as failed") {
+            buf->write_index = 0;
+            ecdc_begin_batch(console);
+            ecdc_feed(console, "led 0123456789abcdef\nled\n", 25);
+            ecdc_end_batch(console);
+
+            assert_ok(3 == led_count);
+            assert_ok(written_contains(buf, "batch: 2 lines, 1 failed: 1\r\n"));
+        }
+
+        it("can echo again once the batch is done") {
+            buf->write_index = 0;
+            ecdc_feed(console, "led\r", 4);
+
+            assert_ok(4 == led_count);
+            assert_ok(written_contains(buf, "led\r\n"));
+        }
+
+        it("can check the deadline between lines") {
+            static const char SCRIPT[] = "\rled\nled\nled\n";
+            struct simple_buf * script_buf =
+                alloc_simple_buf(sizeof(SCRIPT) - 1);
+            memcpy(script_buf->read_data, SCRIPT, sizeof(SCRIPT) - 1);
+
+            int script_count = 0;
+            struct ecdc_console * script_console =
+                ecdc_alloc_console(script_buf, mock_getc, mock_puts, 16, 4);
+            struct ecdc_command * script_command = ecdc_alloc_command(
+                &script_count, script_console, "led", test_count_callback);
+            ecdc_begin_batch(script_console);
+
+            // The deadline has always passed, so each pump runs a line at most
+            int i;
+            for(i = 0; (i < 20) && (script_count < 3); ++i) {
+                int last_count = script_count;
+                (void) ecdc_pump_console_budget(
+                    script_console, (size_t) -1, test_pump_budget_deadline);
+                assert_ok(script_count <= last_count + 1);
+            }
+            assert_ok(3 == script_count);
+
+            ecdc_free_command(script_command);
+            ecdc_free_console(script_console);
+            free_simple_buf(script_buf);
+        }
+
+        it("will not start batch mode on STX unless configured to") {
+            ecdc_configure_console(console, ECDC_MODE_ANSI, ECDC_SET_LOCAL_ECHO);
+            buf->write_index = 0;
+            ecdc_feed(console, "\x02led\r", 5);
+
+            // Still echoed, so not in batch mode
+            assert_ok(5 == led_count);
+            assert_ok(written_contains(buf, "led\r\n"));
+        }
+
+        it("can free a console") {
+            ecdc_free_command(command);
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+
+
+#if ECDC_ENABLE_STATS
+static unsigned long
+test_stats_clock(void * console_hint)
+{
+    // Every reading is 5 ticks after the last
+    static unsigned long ticks = 0;
+    (void) console_hint;
+
+    ticks += 5;
+    return ticks;
+}
+
+
+static int
+test_stats(void)
+{
+    describe("embedded-c-debug-console can count what it does") {
+
+        struct simple_buf * buf = alloc_simple_buf(1024);
+        struct ecdc_stats stats;
+        int led_count = 0;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 16, 4);
+            assert_not_null(console);
+            ecdc_set_stats_clock(console, test_stats_clock);
+        }
+
+        struct ecdc_command * led = NULL;
+        struct ecdc_command * stats_command = NULL;
+        it("can allocate a stats command") {
+            led = ecdc_alloc_command(&led_count, console, "led",
+                                     test_count_callback);
+            assert_not_null(led);
+            stats_command = ecdc_alloc_stats_command(console, "stats");
+            assert_not_null(stats_command);
+        }
+
+        it("can start at zero") {
+            assert_ok(0 == ecdc_get_stats(console, &stats));
+            assert_ok(0 == stats.bytes_received);
+            assert_ok(0 == stats.lines_dispatched);
+        }
+
+        it("can count input, lines, and output") {
+            ecdc_feed(console, "led\rnope\r", 9);
+
+            assert_ok(0 == ecdc_get_stats(console, &stats));
+            assert_ok(9 == stats.bytes_received);
+            assert_ok(2 == stats.lines_dispatched);
+            assert_ok(1 == stats.unknown_commands);
+            assert_ok(buf->write_index == stats.bytes_sent);
+            assert_ok(buf->write_calls == stats.send_calls);
+            assert_ok(5 == stats.max_pump_ticks);
+        }
+
+        it("can count overflow drops and aborted escape sequences") {
+            ecdc_feed(console, "led 0123456789abcdef\r", 21);
+            ecdc_feed(console, "\x1B[\x18", 3);
+
+            assert_ok(0 == ecdc_get_stats(console, &stats));
+            assert_ok(4 == stats.overflow_drops);
+            assert_ok(1 == stats.escape_aborts);
+        }
+
+        it("can print the counters") {
+            ecdc_feed(console, "stats\r", 6);
+            assert_ok(written_contains(buf, "lines_dispatched 4\r\n"));
+            assert_ok(written_contains(buf, "unknown_commands 1\r\n"));
+            assert_ok(written_contains(buf, "overflow_drops   4\r\n"));
+        }
+
+        it("can reset the counters") {
+            ecdc_feed(console, "stats reset\r", 12);
+            assert_ok(0 == ecdc_get_stats(console, &stats));
+            assert_ok(0 == stats.lines_dispatched);
+            assert_ok(0 == stats.overflow_drops);
+
+            ecdc_reset_stats(console);
+            assert_ok(0 == ecdc_get_stats(console, &stats));
+            assert_ok(0 == stats.bytes_sent);
+        }
+
+        it("can free a console") {
+            ecdc_free_command(stats_command);
+            ecdc_free_command(led);
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+#endif
+
+
+#if ECDC_ENABLE_PROFILER
+static unsigned long
+test_profile_clock(void * console_hint)
+{
+    // Every call is timed at 1000 cycles
+    static unsigned long cycles = 0;
+    (void) console_hint;
+
+    cycles += 1000;
+    return cycles;
+}
+
+
+static int
+test_profile(void)
+{
+    describe("embedded-c-debug-console can profile commands") {
+
+        struct simple_buf * buf = alloc_simple_buf(1024);
+        struct ecdc_profile profile;
+        int led_count = 0;
+        int res_count = 0;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 32, 4);
+            assert_not_null(console);
+            ecdc_configure_console(console, ECDC_MODE_ANSI,
+                                   ECDC_SET_PREFIX_MATCH);
+        }
+
+        struct ecdc_command * led = NULL;
+        struct ecdc_command * res = NULL;
+        struct ecdc_command * prof = NULL;
+        it("can allocate a profiler command") {
+            led = ecdc_alloc_command(&led_count, console, "led",
+                                     test_count_callback);
+            assert_not_null(led);
+            res = ecdc_alloc_resumable_command(&res_count, console, "resume",
+                                               test_resumable_callback);
+            assert_not_null(res);
+            prof = ecdc_alloc_profile_command(console, "prof");
+            assert_not_null(prof);
+        }
+
+        it("can skip profiling without a clock") {
+            ecdc_feed(console, "led\r", 4);
+            assert_ok(1 == led_count);
+            assert_ok(0 == ecdc_get_profile(led, &profile));
+            assert_ok(0 == profile.calls);
+        }
+
+        it("can time command calls") {
+            ecdc_set_profile_clock(console, test_profile_clock);
+            ecdc_feed(console, "led\rled\r", 8);
+
+            assert_ok(0 == ecdc_get_profile(led, &profile));
+            assert_ok(2 == profile.calls);
+            assert_ok(2000 == profile.total_cycles);
+            assert_ok(1000 == profile.max_cycles);
+            assert_ok(2 == profile.histogram[3]);
+        }
+
+        it("can time each step of a prefix matched resumable command") {
+            // The steps after the first are taken by the next pumps
+            ecdc_feed(console, "res\r", 4);
+            ecdc_pump_console(console);
+            ecdc_pump_console(console);
+            assert_ok(3 == res_count);
+
+            assert_ok(0 == ecdc_get_profile(res, &profile));
+            assert_ok(3 == profile.calls);
+            assert_ok(3000 == profile.total_cycles);
+        }
+
+        it("can print the profiles") {
+            ecdc_feed(console, "prof\r", 5);
+            assert_ok(written_contains(buf, "led                   2 "));
+            assert_ok(written_contains(buf, " 10:2\r\n"));
+            assert_ok(written_contains(buf, " 10:3\r\n"));
+        }
+
+        it("can reset the profiles") {
+            ecdc_feed(console, "prof reset\r", 11);
+            assert_ok(0 == ecdc_get_profile(led, &profile));
+            assert_ok(0 == profile.calls);
+            assert_ok(0 == profile.histogram[3]);
+
+            ecdc_reset_profiles(console);
+            assert_ok(0 == ecdc_get_profile(prof, &profile));
+            assert_ok(0 == profile.calls);
+            assert_ok(-1 == ecdc_get_profile(NULL, &profile));
+        }
+
+        it("can free a console") {
+            ecdc_free_command(prof);
+            ecdc_free_command(res);
+            ecdc_free_command(led);
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+#endif /* ECDC_ENABLE_PROFILER */
+
+
+#if ECDC_ENABLE_TRACE
+static unsigned long
+test_trace_clock(void * console_hint)
+{
+    static unsigned long ticks = 0;
+    (void) console_hint;
+
+    return ++ticks;
+}
+
+
+static int
+test_trace(void)
+{
+    describe("embedded-c-debug-console can trace its events") {
+
+        struct simple_buf * buf = alloc_simple_buf(2048);
+        struct ecdc_trace_entry entries[16];
+        int led_count = 0;
+
+        struct ecdc_console * console = NULL;
+        it("can allocate a console") {
+            console = ecdc_alloc_console(buf, NULL, mock_puts, 16, 4);
+            assert_not_null(console);
+            assert_ok(0 == ecdc_read_trace(console, entries, 16));
+        }
+
+        it("can allocate a trace") {
+            assert_ok(-1 == ecdc_alloc_trace(console, 6));
+            assert_ok(0 == ecdc_alloc_trace(console, 8));
+            assert_ok(-1 == ecdc_alloc_trace(console, 8));
+            ecdc_set_trace_clock(console, test_trace_clock);
+        }
+
+        struct ecdc_command * led = NULL;
+        struct ecdc_command * trace = NULL;
+        it("can allocate a trace command") {
+            led = ecdc_alloc_command(&led_count, console, "led",
+                                     test_count_callback);
+            assert_not_null(led);
+            trace = ecdc_alloc_trace_command(console, "trace");
+            assert_not_null(trace);
+        }
+
+        it("can record input and dispatches") {
+            ecdc_feed(console, "led\r", 4);
+            assert_ok(5 == ecdc_read_trace(console, entries, 16));
+
+            assert_ok(ECDC_TRACE_INPUT == entries[0].event);
+            assert_ok('l' == entries[0].payload);
+            assert_ok(ECDC_TRACE_INPUT == entries[3].event);
+            assert_ok('\r' == entries[3].payload);
+            assert_ok(ECDC_TRACE_DISPATCH == entries[4].event);
+            assert_ok(1 == entries[4].payload);
+
+            assert_ok(entries[0].timestamp < entries[4].timestamp);
+            assert_not_null(entries[4].state);
+        }
+
+        it("can keep the most recent events") {
+            ecdc_feed(console, "x\r", 2);
+            assert_ok(7 == ecdc_read_trace(console, entries, 16));
+            assert_ok('d' == entries[0].payload);
+            assert_ok(ECDC_TRACE_UNKNOWN_COMMAND == entries[6].event);
+
+            assert_ok(2 == ecdc_read_trace(console, entries, 2));
+            assert_ok(ECDC_TRACE_DISPATCH == entries[0].event);
+            assert_ok(ECDC_TRACE_UNKNOWN_COMMAND == entries[1].event);
+        }
+
+        it("can record overflows and aborted escape sequences") {
+            ecdc_feed(console, "led 0123456789abcdef\r", 21);
+            assert_ok(7 == ecdc_read_trace(console, entries, 16));
+            assert_ok(ECDC_TRACE_OVERFLOW == entries[4].event);
+            assert_ok('f' == entries[4].payload);
+
+            ecdc_feed(console, "\x1B[\x18", 3);
+            assert_ok(7 == ecdc_read_trace(console, entries, 16));
+            assert_ok(ECDC_TRACE_ESCAPE_ABORT == entries[6].event);
+        }
+
+        it("can dump the trace") {
+            ecdc_feed(console, "trace\r", 6);
+            assert_ok(written_contains(buf, "input            116\r\n"));
+            assert_ok(written_contains(buf, "dispatch         1\r\n"));
+        }
+
+        it("can free a console") {
+            ecdc_free_command(trace);
+            ecdc_free_command(led);
+            ecdc_free_console(console);
+        }
+
+        free_simple_buf(buf);
+    }
+
+    return assert_failures();
+}
+#endif /* ECDC_ENABLE_TRACE */
+
+
+#if ECDC_ENABLE_REGISTRY
+static int
+test_registry(void)
+{
+    describe("embedded-c-debug-console can share a registry") {
+
+        struct simple_buf * buf_1 = alloc_simple_buf(512);
+        struct simple_buf * buf_2 = alloc_simple_buf(512);
+
+        struct ecdc_registry * registry = NULL;
+        it("can allocate a registry") {
+            registry = ecdc_alloc_registry(2);
+            assert_not_null(registry);
+        }
+
+        struct ecdc_console * console_1 = NULL;
+        struct ecdc_console * console_2 = NULL;
+        struct ecdc_console * console_3 = NULL;
+        it("can attach consoles") {
+            console_1 = ecdc_alloc_console(buf_1, NULL, mock_puts, 80, 6);
+            console_2 = ecdc_alloc_console(buf_2, NULL, mock_puts, 80, 6);
+            console_3 = ecdc_alloc_console(buf_2, NULL, mock_puts, 80, 6);
+            assert_not_null(console_1);
+            assert_not_null(console_2);
+            assert_not_null(console_3);
+
+            assert_ok(0 == ecdc_attach_registry(console_1, registry));
+            assert_ok(0 == ecdc_attach_registry(console_2, registry));
+        }
+
+        it("will not attach more consoles than reader slots") {
+            assert_ok(0 != ecdc_attach_registry(console_3, registry));
+        }
+
+        int call_count = 0;
+        it("can add commands") {
+            assert_ok(0 == ecdc_registry_add(
+                registry, "shared_b", test_count_callback, &call_count));
+            assert_ok(0 == ecdc_registry_add(
+                registry, "shared_a", test_count_callback, &call_count));
+            assert_ok(0 == ecdc_registry_add(
+                registry, "shared_c", test_count_callback, &call_count));
+        }
+
+        it("will not add a command twice") {
+            assert_ok(0 != ecdc_registry_add(
+                registry, "shared_a", test_count_callback, &call_count));
+        }
+
+        it("can dispatch from every attached console") {
+            static const char TEST_STRING[] = "\rshared_a\rshared_c\r";
+            ecdc_feed(console_1, TEST_STRING, sizeof(TEST_STRING) - 1);
+            ecdc_feed(console_2, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(4 == call_count);
+        }
+
+        it("can remove commands") {
+            assert_ok(0 == ecdc_registry_remove(registry, "shared_a"));
+            assert_ok(0 != ecdc_registry_remove(registry, "shared_a"));
+
+            static const char TEST_STRING[] = "\rshared_a\rshared_b\r";
+            ecdc_feed(console_1, TEST_STRING, sizeof(TEST_STRING) - 1);
+            assert_ok(5 == call_count);
+            assert_ok(written_contains(buf_1, "'shared_a' not found"));
+        }
+
+        it("can reuse a reader slot once a console is detached") {
+            ecdc_detach_registry(console_2);
+            assert_ok(0 == ecdc_attach_registry(console_3, registry));
+        }
+
+        it("can free consoles and the registry") {
+            ecdc_free_console(console_1);
+            ecdc_free_console(console_2);
+            ecdc_free_console(console_3);
+            ecdc_free_registry(registry);
+        }
+
+        free_simple_buf(buf_1);
+        free_simple_buf(buf_2);
+    }
+
+    return assert_failures();
+}
+#endif /* ECDC_ENABLE_REGISTRY */
+
+
+
 int
 main(int argc, char const *argv[])
 {
@@ -574,6 +2922,39 @@ main(int argc, char const *argv[])
         || test_parse_1()
         || test_parse_2()
         || test_prompt_write()
+        || test_bulk_read()
+        || test_output_buffer()
+        || test_many_commands()
+        || test_static_storage()
+        || test_command_pool()
+        || test_command_group()
+        || test_pump_budget()
+        || test_feed()
+        || test_backspace_split()
+        || test_completion()
+        || test_history()
+        || test_resumable()
+        || test_output_queue()
+        || test_out_reserve()
+        || test_printf()
+        || test_framed()
+        || test_batch()
+        || test_rx_ring()
+#if ECDC_ENABLE_STATS
+        || test_stats()
+#endif
+#if ECDC_ENABLE_PROFILER
+        || test_profile()
+#endif
+#if ECDC_ENABLE_TRACE
+        || test_trace()
+#endif
+#if ECDC_ENABLE_REGISTRY
+        || test_registry()
+#endif
+#if ECDC_ENABLE_STATIC_COMMANDS
+        || test_static_command()
+#endif
     );
 }
 